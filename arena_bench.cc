@@ -0,0 +1,144 @@
+/*
+ * arena_bench.cc - mm::arena_scope regions against malloc/free on mm.
+ *
+ * Both sides serve REQUESTS requests of phase-structured work: each
+ * request builds a list of 16 to 128 byte records that lives for the whole
+ * request, and for every record a few short-lived temporaries that only
+ * live while that record is built. "malloc/free" frees every object on
+ * its own; "arena" opens an arena_scope per request and a nested one per
+ * record, so the temporaries go when the inner scope ends and the records
+ * when the request does. The records are summed before the request ends,
+ * which also checks that the inner scopes never freed what the outer one
+ * still holds. Times are K-best fsec() runs on a freshly reset heap.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_arena.h"
+extern "C" {
+#include "fcyc.h"
+}
+
+struct record {
+    record *next;
+    size_t len;
+    unsigned char data[];
+};
+
+static const int REQUESTS = 2000;
+static const int RECORDS = 100;
+static const int TEMPS = 4;
+static unsigned long checksum;
+static size_t heap_used;
+
+static void reset_heap()
+{
+    mem_reset_brk();
+    if (!mm_init()) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+}
+
+static size_t record_len(int req, int i)
+{
+    return 16 + (size_t)(req * 31 + i * 7) % 113;
+}
+
+/* Fills a record from its temporaries, which are then dropped */
+static void fill(record *r, void **temps, int req, int i)
+{
+    for (int t = 0; t < TEMPS; t++)
+        memset(temps[t], req + i + t, r->len);
+    for (size_t b = 0; b < r->len; b++)
+        r->data[b] = static_cast<unsigned char *>(temps[b % TEMPS])[b];
+}
+
+static unsigned long sum(const record *head)
+{
+    unsigned long s = 0;
+    for (const record *r = head; r != nullptr; r = r->next)
+        for (size_t b = 0; b < r->len; b++)
+            s += r->data[b];
+    return s;
+}
+
+static void run_malloc(void *arg)
+{
+    reset_heap();
+    checksum = 0;
+    for (int req = 0; req < REQUESTS; req++) {
+        record *head = nullptr;
+        for (int i = 0; i < RECORDS; i++) {
+            size_t len = record_len(req, i);
+            record *r = static_cast<record *>(mm_malloc(sizeof(record) + len));
+            r->len = len;
+            void *temps[TEMPS];
+            for (int t = 0; t < TEMPS; t++)
+                temps[t] = mm_malloc(len);
+            fill(r, temps, req, i);
+            for (int t = 0; t < TEMPS; t++)
+                mm_free(temps[t]);
+            r->next = head;
+            head = r;
+        }
+        checksum += sum(head);
+        while (head != nullptr) {
+            record *next = head->next;
+            mm_free(head);
+            head = next;
+        }
+    }
+    heap_used = mm_heapsize();
+}
+
+static void run_arena(void *arg)
+{
+    reset_heap();
+    checksum = 0;
+    mm_arena_t *arena = mm_arena_create(0);
+    for (int req = 0; req < REQUESTS; req++) {
+        mm::arena_scope request(arena);
+        record *head = nullptr;
+        for (int i = 0; i < RECORDS; i++) {
+            size_t len = record_len(req, i);
+            record *r = static_cast<record *>(request.alloc(sizeof(record) + len));
+            r->len = len;
+            mm::arena_scope build(arena);
+            void *temps[TEMPS];
+            for (int t = 0; t < TEMPS; t++)
+                temps[t] = build.alloc(len);
+            fill(r, temps, req, i);
+            r->next = head;
+            head = r;
+        }
+        checksum += sum(head);
+    }
+    mm_arena_destroy(arena);
+    heap_used = mm_heapsize();
+}
+
+int main()
+{
+    double ops = (double)REQUESTS * RECORDS * (1 + TEMPS);
+
+    mem_init();
+
+    double malloc_secs = fsec(run_malloc, nullptr);
+    size_t malloc_heap = heap_used;
+    unsigned long expect = checksum;
+    double arena_secs = fsec(run_arena, nullptr);
+    size_t arena_heap = heap_used;
+
+    printf("%-22s %10s %12s\n", "", "Kops", "heap bytes");
+    printf("%-22s %10.0f %12zu\n", "malloc/free on mm", ops / malloc_secs * 1e-3, malloc_heap);
+    printf("%-22s %10.0f %12zu\n", "mm::arena_scope", ops / arena_secs * 1e-3, arena_heap);
+    printf("arena/malloc = %.2f, records %s\n", malloc_secs / arena_secs,
+           checksum == expect ? "intact" : "DAMAGED");
+
+    mem_deinit();
+    return checksum == expect ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+#!/usr/bin/perl
+use Getopt::Std;
+use Cwd qw(abs_path getcwd);
+use File::Temp qw(tempdir);
+use File::Basename qw(basename);
+use POSIX qw(strftime);
+
+##############################################################################
+#
+# Searches the build-time tunables in mm_tune.h (size-class boundaries,
+# split threshold, heap growth chunk, fast-bin limit) over the trace suite.
+# Every candidate is built into its own directory with TUNE_FLAGS and run
+# through mdriver, several at a time. The Pareto front of utilization and
+# throughput is timed again one candidate at a time, and written to
+# mm_tuned.h with its best-utilization, best-throughput and best-index
+# settings, which `make TUNE=space|speed|index` then builds with.
+#
+##############################################################################
+
+sub usage
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-hvkS] [-j JOBS] [-n CANDIDATES] [-s SEED] [-o FILE] [-t DIR] [-a ARGS]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "   -h              Print this message\n";
+    printf STDERR "   -v              Verbose mode\n";
+    printf STDERR "   -j JOBS         Build and run JOBS candidates at a time (default: cores)\n";
+    printf STDERR "   -n CANDIDATES   Try CANDIDATES settings, the defaults included (default 40)\n";
+    printf STDERR "   -s SEED         Seed for sampling the search space\n";
+    printf STDERR "   -o FILE         Write the generated header to FILE (default mm_tuned.h)\n";
+    printf STDERR "   -t DIR          Trace directory (default ./traces/)\n";
+    printf STDERR "   -a ARGS         Extra mdriver arguments, e.g. '-f traces/bdd-aa4.rep'\n";
+    printf STDERR "   -k              Keep the candidate build directories\n";
+    printf STDERR "   -S              Do NOT write the header\n";
+    die "\n";
+}
+
+$| = 1;       # Autoflush output on every print statement
+
+getopts('hvkSj:n:s:o:t:a:');
+
+if ($opt_h) {
+    &usage($ARGV[0]);
+}
+
+$verbose = $opt_v ? 1 : 0;
+$jobs = $opt_j ? $opt_j : `nproc 2> /dev/null` + 0;
+$jobs = 1 if ($jobs < 1);
+$ncand = $opt_n ? $opt_n : 40;
+$outfile = $opt_o ? $opt_o : "mm_tuned.h";
+$tracedir = abs_path($opt_t ? $opt_t : "./traces") . "/";
+$driver_args = $opt_a ? $opt_a : "";
+srand($opt_s) if (defined $opt_s);
+
+# The search space. Class boundaries are geometric: the first bound and
+# the ratio between bounds, rounded up to 16 bytes
+@class_starts = (32, 48, 64);
+@class_ratios = (1.5, 2, 3);
+@split_mins = (32, 48, 64, 128);
+@grow_chunks = (0, 4096, 16384, 65536);
+@fast_maxes = (128, 256, 512);
+
+# Files a candidate build needs
+$srcdir = getcwd();
+@build_files = (glob("*.c"), glob("*.h"), glob("*.pl"), glob("*.sh"),
+                "Makefile", "throughputs.txt", "mdriver-ref");
+
+sub class_bounds
+{
+    my ($start, $ratio) = @_;
+    my @bounds = ();
+    my $b = $start;
+    for (my $i = 0; $i < 13; $i++) {
+        my $r = int(($b + 15) / 16) * 16;
+        $r = $bounds[-1] + 16 if (@bounds && $r <= $bounds[-1]);
+        push @bounds, $r;
+        $b *= $ratio;
+    }
+    join(", ", @bounds);
+}
+
+sub describe
+{
+    my ($c) = @_;
+    "classes $c->{start}x$c->{ratio} split $c->{split} chunk $c->{chunk} fast $c->{fast}";
+}
+
+sub tune_flags
+{
+    my ($c) = @_;
+    my $bounds = class_bounds($c->{start}, $c->{ratio});
+    $bounds =~ s/ //g;
+    "-DMM_CLASS_BOUNDS=$bounds -DMM_SPLIT_MIN=$c->{split} " .
+        "-DMM_GROW_CHUNK=$c->{chunk} -DMM_FAST_MAX=$c->{fast}";
+}
+
+# Pick the candidates: the hand-tuned defaults, then distinct random points
+@cands = ({start => 32, ratio => 2, split => 32, chunk => 0, fast => 256});
+%seen = (describe($cands[0]) => 1);
+$space = @class_starts * @class_ratios * @split_mins * @grow_chunks * @fast_maxes;
+$ncand = $space if ($ncand > $space);
+while (@cands < $ncand) {
+    my $c = {start => $class_starts[int(rand(@class_starts))],
+             ratio => $class_ratios[int(rand(@class_ratios))],
+             split => $split_mins[int(rand(@split_mins))],
+             chunk => $grow_chunks[int(rand(@grow_chunks))],
+             fast => $fast_maxes[int(rand(@fast_maxes))]};
+    next if ($seen{describe($c)}++);
+    push @cands, $c;
+}
+
+$workdir = tempdir("autotune.XXXXXX", TMPDIR => 1, CLEANUP => !$opt_k);
+print "Trying $ncand of $space settings, $jobs at a time, in $workdir\n";
+
+# Build candidate $k in its own directory and run mdriver there; the
+# result file holds "util tput index", or "invalid"
+sub run_candidate
+{
+    my ($k) = @_;
+    my $c = $cands[$k];
+    my $dir = "$workdir/c$k";
+    my $flags = tune_flags($c);
+    mkdir($dir) || die "Couldn't create $dir\n";
+    system("cp @build_files $dir/") == 0 || die "Couldn't copy sources to $dir\n";
+    symlink($tracedir, "$dir/traces");   # mdriver-ref reads ./traces
+    my $result = "invalid";
+    if (system("make -s -C $dir mdriver TUNE_FLAGS='$flags' > $dir/build.log 2>&1") == 0) {
+        my $out = `cd $dir && ./mdriver -t $tracedir $driver_args 2>&1`;
+        open(my $log, ">", "$dir/mdriver.log");
+        print $log $out;
+        close($log);
+        if ($out !~ /Terminated with/ &&
+            $out =~ /Final perf index = .* = ([\d.]+)\/100.0\*\*\*\s*Average utilization = ([\d.]+)%\. Average throughput = ([\d.]+) Kops/) {
+            $result = "$2 $3 $1";
+        }
+    }
+    open(my $fh, ">", "$dir/result") || die "Couldn't write $dir/result\n";
+    print $fh "$result\n";
+    close($fh);
+}
+
+# Run candidates @_ with at most $n of them at once, then read the results
+sub run_all
+{
+    my ($n, @ks) = @_;
+    my $running = 0;
+    for my $k (@ks) {
+        if ($running >= $n) {
+            wait();
+            $running--;
+        }
+        system("rm -rf $workdir/c$k");
+        my $pid = fork();
+        die "Couldn't fork\n" if (!defined $pid);
+        if ($pid == 0) {
+            run_candidate($k);
+            exit(0);
+        }
+        $running++;
+        print "  [$k] " . describe($cands[$k]) . "\n" if ($verbose > 0);
+    }
+    while ($running-- > 0) {
+        wait();
+    }
+    for my $k (@ks) {
+        my $r = `cat $workdir/c$k/result 2> /dev/null`;
+        chomp($r);
+        if ($r =~ /^([\d.]+) ([\d.]+) ([\d.]+)$/) {
+            ($cands[$k]{util}, $cands[$k]{tput}, $cands[$k]{index}) = ($1, $2, $3);
+            $cands[$k]{valid} = 1;
+        } else {
+            $cands[$k]{valid} = 0;
+            print "  [$k] " . describe($cands[$k]) . ": build or trace failure, see $workdir/c$k\n";
+        }
+    }
+}
+
+# Candidates no other valid candidate beats on both utilization and throughput
+sub pareto
+{
+    my @ks = grep { $cands[$_]{valid} } @_;
+    my @front = ();
+    for my $a (@ks) {
+        my $dominated = 0;
+        for my $b (@ks) {
+            my ($ca, $cb) = ($cands[$a], $cands[$b]);
+            if ($cb->{util} >= $ca->{util} && $cb->{tput} >= $ca->{tput} &&
+                ($cb->{util} > $ca->{util} || $cb->{tput} > $ca->{tput})) {
+                $dominated = 1;
+                last;
+            }
+        }
+        push @front, $a if (!$dominated);
+    }
+    sort { $cands[$a]{util} <=> $cands[$b]{util} } @front;
+}
+
+sub best
+{
+    my ($key, $tie, @ks) = @_;
+    my @sorted = sort { $cands[$b]{$key} <=> $cands[$a]{$key} ||
+                        $cands[$b]{$tie} <=> $cands[$a]{$tie} } @ks;
+    $sorted[0];
+}
+
+run_all($jobs, 0 .. $#cands);
+@front = pareto(0 .. $#cands);
+die "No candidate built and passed the traces\n" if (!@front);
+
+# Parallel runs share the cores, so time the front again one at a time
+if ($jobs > 1) {
+    print "Timing the " . scalar(@front) . " Pareto candidates one at a time\n";
+    run_all(1, @front);
+    @front = pareto(@front);
+}
+
+printf("\n%6s %8s %6s  %s\n", "util", "Kops", "index", "settings");
+@lines = ();
+for my $k (@front) {
+    my $c = $cands[$k];
+    my $line = sprintf("%5.1f%% %8.0f %6.1f  %s%s", $c->{util}, $c->{tput}, $c->{index},
+                       describe($c), $k == 0 ? " (defaults)" : "");
+    print "$line\n";
+    push @lines, $line;
+}
+if (!grep { $_ == 0 } @front) {
+    my $c = $cands[0];
+    printf("defaults: %.1f%% %.0f Kops index %.1f\n", $c->{util}, $c->{tput}, $c->{index})
+        if ($c->{valid});
+}
+
+%picks = (SPACE => best("util", "tput", @front),
+          SPEED => best("tput", "util", @front),
+          INDEX => best("index", "util", @front));
+
+if ($opt_S) {
+    exit(0);
+}
+
+open(my $out, ">", $outfile) || die "Couldn't write $outfile\n";
+print $out "#ifndef __MM_TUNED_H_\n#define __MM_TUNED_H_\n\n";
+print $out "/*\n";
+print $out " * " . basename($outfile) . " - generated by autotune.pl on " .
+    strftime("%Y-%m-%d", localtime) . "; do not edit.\n";
+print $out " *\n";
+print $out " * $ncand candidates on $tracedir $driver_args\n";
+print $out " * Pareto front of utilization and throughput:\n";
+print $out " *   $_\n" for (@lines);
+print $out " */\n";
+$first = 1;
+for my $name ("SPACE", "SPEED", "INDEX") {
+    my $c = $cands[$picks{$name}];
+    if ($name eq "INDEX") {
+        print $out "#else /* best performance index */\n";
+    } else {
+        printf $out "#%s defined(MM_TUNE_FOR_%s)\n", $first ? "if" : "elif", $name;
+    }
+    $first = 0;
+    printf $out "#define MM_CLASS_BOUNDS %s\n", class_bounds($c->{start}, $c->{ratio});
+    printf $out "#define MM_SPLIT_MIN %d\n", $c->{split};
+    printf $out "#define MM_GROW_CHUNK %d\n", $c->{chunk};
+    printf $out "#define MM_FAST_MAX %d\n", $c->{fast};
+}
+print $out "#endif\n\n#endif /* __MM_TUNED_H_ */\n";
+close($out);
+print "\nWrote $outfile; build with make TUNE=index, TUNE=space or TUNE=speed\n";
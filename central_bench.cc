@@ -0,0 +1,110 @@
+/*
+ * central_bench.cc - refill and flush traffic on the central free lists,
+ * lock-free against mutex-protected (mm_central.h).
+ *
+ * Every thread loops doing what a thread cache does when it runs dry and
+ * fills up again: pop a batch from a class, then push back the batch it
+ * popped the round before, so each thread holds one batch at a time. The
+ * classes are picked at random over the few a typical program keeps hot,
+ * so threads collide on the same lists. The table gives million batch
+ * transfers per second for 1 to MAX_THREADS threads (or the argument); on
+ * a machine with fewer cores than threads it measures preemption inside
+ * the critical section rather than scaling.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "mm_central.h"
+
+static const int MAX_THREADS = 64;
+static const int HOT_CLASSES = 4;
+static const int BATCHES_PER_CLASS = 256;
+static const int BATCH = 32;
+static const int BLOCK = 32;
+static const double SECONDS = 0.3;
+
+/* Blocks for every batch: BLOCK bytes each, linked through their first word */
+static char *make_batches(mm_central_t *c)
+{
+    size_t bytes = (size_t)HOT_CLASSES * BATCHES_PER_CLASS * BATCH * BLOCK;
+    char *mem = static_cast<char *>(std::aligned_alloc(64, bytes));
+    char *p = mem;
+    for (int cls = 0; cls < HOT_CLASSES; cls++) {
+        for (int b = 0; b < BATCHES_PER_CLASS; b++) {
+            char *first = p;
+            for (int i = 0; i < BATCH; i++, p += BLOCK)
+                *(char **)p = i + 1 < BATCH ? p + BLOCK : nullptr;
+            mm_central_push(c, cls, mm_batch_make(first, BATCH));
+        }
+    }
+    return mem;
+}
+
+static void transfer(mm_central_t *c, unsigned seed, const volatile bool *stop, long *ops)
+{
+    long n = 0;
+    int held_cls = 0;
+    void *held = nullptr;
+    while (!*stop) {
+        for (int k = 0; k < 256; k++) {
+            seed = seed * 1103515245 + 12345;
+            int cls = (seed >> 16) % HOT_CLASSES;
+            void *b = mm_central_pop(c, cls);
+            if (held != nullptr)
+                mm_central_push(c, held_cls, held);
+            held = b;
+            held_cls = cls;
+            n += 2;
+        }
+    }
+    if (held != nullptr)
+        mm_central_push(c, held_cls, held);
+    *ops = n;
+}
+
+/* Million transfers per second with threads threads */
+static double run(bool locked, int threads)
+{
+    mm_central_t c;
+    mm_central_init(&c, locked);
+    char *mem = make_batches(&c);
+
+    volatile bool stop = false;
+    std::vector<long> ops(threads);
+    std::vector<std::thread> ts;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++)
+        ts.emplace_back(transfer, &c, (unsigned)t * 7919 + 1, &stop, &ops[t]);
+    std::this_thread::sleep_for(std::chrono::duration<double>(SECONDS));
+    stop = true;
+    for (auto &t : ts)
+        t.join();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    long total = 0;
+    for (long n : ops)
+        total += n;
+    for (int cls = 0; cls < HOT_CLASSES; cls++) {
+        if (mm_central_batches(&c, cls) != BATCHES_PER_CLASS) {
+            fprintf(stderr, "class %d lost batches\n", cls);
+            exit(1);
+        }
+    }
+    std::free(mem);
+    return total / secs * 1e-6;
+}
+
+int main(int argc, char **argv)
+{
+    int max = argc > 1 ? atoi(argv[1]) : MAX_THREADS;
+    printf("%-8s %10s %10s %8s\n", "threads", "lock-free", "mutex", "ratio");
+    for (int t = 1; t <= max; t *= 2) {
+        double lf = run(false, t);
+        double mx = run(true, t);
+        printf("%-8d %10.1f %10.1f %8.2f\n", t, lf, mx, lf / mx);
+    }
+    return 0;
+}
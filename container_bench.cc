@@ -0,0 +1,142 @@
+/*
+ * container_bench.cc - standard containers on the default allocator, on
+ * mm::allocator<T>, and on pmr containers backed by mm::memory_resource.
+ *
+ * Three churn workloads, each run K-best with fsec() on a freshly reset
+ * mm heap:
+ *   vector  - grow many short vectors by push_back, then drop them
+ *   map     - insert into and erase from an unordered_map in waves
+ *   string  - build, append to and drop heap-sized (non-SSO) strings
+ * "std" is std::allocator, i.e. the C library malloc this binary links.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_resource.h"
+extern "C" {
+#include "fcyc.h"
+}
+
+static const int VECTORS = 2000;
+static const int VECTOR_LEN = 200;
+static const int MAP_KEYS = 50000;
+static const int MAP_WAVES = 4;
+static const int STRINGS = 20000;
+static const int STRING_ROUNDS = 4;
+
+static volatile long sink;   /* keeps the optimizer from dropping the work */
+
+static void reset_heap()
+{
+    mem_reset_brk();
+    if (!mm_init()) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+}
+
+template <template <typename> class Alloc>
+static void vector_churn()
+{
+    std::vector<std::vector<long, Alloc<long>>, Alloc<std::vector<long, Alloc<long>>>> vs;
+    for (int round = 0; round < 2; round++) {
+        vs.resize(VECTORS);
+        for (int i = 0; i < VECTOR_LEN; i++)
+            for (int v = 0; v < VECTORS; v++)
+                vs[v].push_back(i + v);
+        sink += vs[VECTORS - 1].back();
+        vs.clear();
+    }
+}
+
+template <template <typename> class Alloc>
+static void map_churn()
+{
+    typedef std::pair<const long, long> value;
+    std::unordered_map<long, long, std::hash<long>, std::equal_to<long>, Alloc<value>> m;
+    for (int w = 0; w < MAP_WAVES; w++) {
+        for (long k = 0; k < MAP_KEYS; k++)
+            m.emplace(k * 7 + w, k);
+        for (long k = 0; k < MAP_KEYS; k += 2)
+            m.erase(k * 7 + w);
+    }
+    sink += (long)m.size();
+}
+
+template <template <typename> class Alloc>
+static void string_churn()
+{
+    typedef std::basic_string<char, std::char_traits<char>, Alloc<char>> string;
+    std::vector<string, Alloc<string>> ss;
+    for (int r = 0; r < STRING_ROUNDS; r++) {
+        for (int i = 0; i < STRINGS; i++)
+            ss.emplace_back(40 + i % 64, 'a' + r);
+        for (int i = 0; i < STRINGS; i += 3)
+            ss[i] += ss[i + 1];
+        sink += (long)ss[STRINGS / 2].size();
+        ss.clear();
+    }
+}
+
+/* Run fn<Alloc> against a clean heap; the pmr side routes through mm */
+template <void (*fn)()>
+static void run(void *arg)
+{
+    reset_heap();
+    bool pmr = arg != nullptr;
+    std::pmr::memory_resource *old = nullptr;
+    if (pmr)
+        old = std::pmr::set_default_resource(mm::heap_resource());
+    fn();
+    if (pmr)
+        std::pmr::set_default_resource(old);
+}
+
+template <typename T>
+using std_alloc = std::allocator<T>;
+template <typename T>
+using pmr_alloc = std::pmr::polymorphic_allocator<T>;
+
+static void report(const char *name, double ops, double std_secs,
+                   double mm_secs, double pmr_secs)
+{
+    printf("%-8s %10.0f %10.0f %10.0f %8.2f %8.2f\n", name,
+           ops / std_secs * 1e-3, ops / mm_secs * 1e-3, ops / pmr_secs * 1e-3,
+           std_secs / mm_secs, std_secs / pmr_secs);
+}
+
+int main()
+{
+    int pmr = 1;
+    mem_init();
+
+    printf("%-8s %10s %10s %10s %8s %8s\n", "Kops", "std", "mm::alloc",
+           "pmr", "mm/std", "pmr/std");
+
+    double ops = 2.0 * VECTORS * VECTOR_LEN;
+    report("vector", ops,
+           fsec(run<vector_churn<std_alloc>>, nullptr),
+           fsec(run<vector_churn<mm::allocator>>, nullptr),
+           fsec(run<vector_churn<pmr_alloc>>, &pmr));
+
+    ops = 1.5 * MAP_KEYS * MAP_WAVES;
+    report("map", ops,
+           fsec(run<map_churn<std_alloc>>, nullptr),
+           fsec(run<map_churn<mm::allocator>>, nullptr),
+           fsec(run<map_churn<pmr_alloc>>, &pmr));
+
+    ops = 1.0 * STRINGS * STRING_ROUNDS * 4 / 3;
+    report("string", ops,
+           fsec(run<string_churn<std_alloc>>, nullptr),
+           fsec(run<string_churn<mm::allocator>>, nullptr),
+           fsec(run<string_churn<pmr_alloc>>, &pmr));
+
+    mem_deinit();
+    return 0;
+}
@@ -0,0 +1,347 @@
+/*
+ * libmm.c - exports the libc allocation symbols on top of mm.c so that
+ * libmm.so can be LD_PRELOADed into real programs.
+ *
+ * mm.c is single threaded and expects mem_init()/mm_init() to have been
+ * called, so every entry point here takes one process-wide lock and the
+ * first call reserves the heap. memlib's heap is a MAP_NORESERVE mapping,
+ * so pages only become resident once the allocator touches them.
+ *
+ * Requests of up to CACHE_MAX bytes skip the lock: each thread keeps a
+ * cache of free blocks, one bin per 16-byte class. An empty bin refills
+ * with a batch from the class's central list (mm_central.h), or else
+ * with CACHE_BATCH blocks from the heap under one lock hold; a bin that
+ * reaches two batches flushes one to the central list, and a central list
+ * holding CENTRAL_MAX batches already sends it back to the heap. A
+ * thread's cache is flushed when it exits. MM_CENTRAL=mutex runs the
+ * central lists on mutexes instead of lock-free, MM_CENTRAL=off turns the
+ * caches off.
+ */
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_central.h"
+
+/* Only the libc names are exported; mm.c's helpers stay hidden */
+#define EXPORT __attribute__((visibility("default")))
+
+#define CACHE_BATCH 32
+#define CENTRAL_MAX 64
+#define CACHE_MAX (MM_CENTRAL_CLASSES * MM_CENTRAL_CLASS_SIZE)
+
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool heap_ready = false;
+static int atfork_registered = 0;
+
+struct cache_bin {
+    void *head;                 /* blocks linked through their first word */
+    size_t count;
+};
+
+static __thread struct cache_bin cache[MM_CENTRAL_CLASSES]
+    __attribute__((tls_model("initial-exec")));
+static __thread bool cache_registered __attribute__((tls_model("initial-exec")));
+static mm_central_t central;
+static bool caches_on = false;
+static pthread_key_t cache_key;
+
+static void prepare_fork(void)
+{
+    pthread_mutex_lock(&heap_lock);
+    if (central.locked)
+        for (int i = 0; i < MM_CENTRAL_CLASSES; i++)
+            pthread_mutex_lock(&central.lists[i].lock);
+}
+
+static void parent_fork(void)
+{
+    if (central.locked)
+        for (int i = 0; i < MM_CENTRAL_CLASSES; i++)
+            pthread_mutex_unlock(&central.lists[i].lock);
+    pthread_mutex_unlock(&heap_lock);
+}
+
+static void child_fork(void)
+{
+    if (central.locked)
+        for (int i = 0; i < MM_CENTRAL_CLASSES; i++)
+            pthread_mutex_init(&central.lists[i].lock, NULL);
+    pthread_mutex_init(&heap_lock, NULL);
+}
+
+static void cache_exit(void *arg);
+
+/* Take the lock and make sure the heap exists */
+static void lock_heap(void)
+{
+    pthread_mutex_lock(&heap_lock);
+    if (!heap_ready) {
+        mem_init();
+        __atomic_store_n(&heap_ready, mm_init(), __ATOMIC_RELEASE);
+        const char *mode = getenv("MM_CENTRAL");
+        if (heap_ready && !(mode && strcmp(mode, "off") == 0) &&
+            pthread_key_create(&cache_key, cache_exit) == 0) {
+            mm_central_init(&central, mode && strcmp(mode, "mutex") == 0);
+            __atomic_store_n(&caches_on, true, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+/*
+ * Release the lock. Fork handlers are registered here, outside the lock,
+ * because pthread_atfork may itself call malloc.
+ */
+static void unlock_heap(void)
+{
+    pthread_mutex_unlock(&heap_lock);
+    if (!__atomic_exchange_n(&atfork_registered, 1, __ATOMIC_ACQ_REL)) {
+        pthread_atfork(prepare_fork, parent_fork, child_fork);
+    }
+}
+
+/* Whether the thread caches are in use; the first call sets up the heap */
+static bool use_caches(void)
+{
+    if (!__atomic_load_n(&heap_ready, __ATOMIC_ACQUIRE)) {
+        lock_heap();
+        unlock_heap();
+    }
+    return __atomic_load_n(&caches_on, __ATOMIC_ACQUIRE);
+}
+
+/* Hands the heap count blocks linked from head, under one lock hold */
+static void heap_release(void *head, size_t count)
+{
+    lock_heap();
+    while (count-- > 0) {
+        void *next = *(void **)head;
+        mm_free(head);
+        head = next;
+    }
+    unlock_heap();
+}
+
+/* Moves count blocks from the front of bin cls to the central list */
+static void cache_flush(int cls, size_t count)
+{
+    struct cache_bin *bin = &cache[cls];
+    void *first = bin->head;
+    void *last = first;
+    for (size_t i = 1; i < count; i++)
+        last = *(void **)last;
+    bin->head = *(void **)last;
+    bin->count -= count;
+    if (mm_central_batches(&central, cls) >= CENTRAL_MAX)
+        heap_release(first, count);
+    else
+        mm_central_push(&central, cls, mm_batch_make(first, count));
+}
+
+/* Thread exit: every bin goes to the central lists */
+static void cache_exit(void *arg)
+{
+    for (int cls = 0; cls < MM_CENTRAL_CLASSES; cls++)
+        if (cache[cls].count > 0)
+            cache_flush(cls, cache[cls].count);
+}
+
+/*
+ * Arranges for cache_exit to run when this thread exits. Called by every
+ * path that puts blocks in a bin: a thread that only frees, or only takes
+ * batches from the central lists, would otherwise strand them.
+ */
+static void cache_register(void)
+{
+    if (!cache_registered) {
+        /* any non-NULL value, so cache_exit runs at thread exit */
+        cache_registered = pthread_setspecific(cache_key, cache) == 0;
+    }
+}
+
+/* Fills empty bin cls from the central list, or else from the heap */
+static bool cache_refill(int cls)
+{
+    struct cache_bin *bin = &cache[cls];
+    cache_register();
+    void *batch = mm_central_pop(&central, cls);
+    if (batch != NULL) {
+        bin->head = batch;
+        bin->count = mm_batch_count(batch);
+        return true;
+    }
+    size_t size = (size_t)(cls + 1) * MM_CENTRAL_CLASS_SIZE;
+    lock_heap();
+    while (bin->count < CACHE_BATCH) {
+        void *p = heap_ready ? mm_malloc(size) : NULL;
+        if (p == NULL)
+            break;
+        *(void **)p = bin->head;
+        bin->head = p;
+        bin->count++;
+    }
+    unlock_heap();
+    return bin->count > 0;
+}
+
+static void *cache_alloc(size_t size)
+{
+    int cls = (int)((size - 1) / MM_CENTRAL_CLASS_SIZE);
+    struct cache_bin *bin = &cache[cls];
+    if (bin->count == 0 && !cache_refill(cls))
+        return NULL;
+    void *p = bin->head;
+    bin->head = *(void **)p;
+    bin->count--;
+    return p;
+}
+
+/*
+ * Takes ptr into its thread's bin if it is small enough. The header read
+ * needs no lock: the block is the caller's, so no one else writes it.
+ */
+static bool cache_free(void *ptr)
+{
+    size_t usable = mm_malloc_usable_size(ptr);
+    if (usable < MM_CENTRAL_CLASS_SIZE + sizeof(size_t) ||
+        usable > CACHE_MAX + sizeof(size_t))
+        return false;
+    int cls = (int)((usable - sizeof(size_t)) / MM_CENTRAL_CLASS_SIZE) - 1;
+    struct cache_bin *bin = &cache[cls];
+    cache_register();
+    *(void **)ptr = bin->head;
+    bin->head = ptr;
+    if (++bin->count >= 2 * CACHE_BATCH)
+        cache_flush(cls, CACHE_BATCH);
+    return true;
+}
+
+EXPORT void *malloc(size_t size)
+{
+    /* mm_malloc(0) is NULL, but callers of libc expect a unique pointer */
+    if (size == 0)
+        size = 1;
+    if (size <= CACHE_MAX && use_caches()) {
+        void *p = cache_alloc(size);
+        if (p == NULL)
+            errno = ENOMEM;
+        return p;
+    }
+    lock_heap();
+    void *p = heap_ready ? mm_malloc(size) : NULL;
+    unlock_heap();
+    if (p == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+EXPORT void free(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    if (use_caches() && cache_free(ptr))
+        return;
+    lock_heap();
+    mm_free(ptr);
+    unlock_heap();
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+    lock_heap();
+    void *p = heap_ready ? mm_realloc(ptr, size) : NULL;
+    unlock_heap();
+    if (p == NULL && size != 0)
+        errno = ENOMEM;
+    return p;
+}
+
+EXPORT void *calloc(size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (nmemb == 0 || size == 0)
+        nmemb = size = 1;
+    if (nmemb * size <= CACHE_MAX && use_caches()) {
+        void *p = cache_alloc(nmemb * size);
+        if (p == NULL)
+            errno = ENOMEM;
+        else
+            memset(p, 0, nmemb * size);
+        return p;
+    }
+    lock_heap();
+    void *p = heap_ready ? mm_calloc(nmemb, size) : NULL;
+    unlock_heap();
+    if (p == NULL)
+        errno = ENOMEM;
+    return p;
+}
+
+EXPORT void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    if (size != 0 && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, nmemb * size);
+}
+
+EXPORT void *memalign(size_t alignment, size_t size)
+{
+    if (size == 0)
+        size = 1;
+    lock_heap();
+    void *p = heap_ready ? mm_memalign(alignment, size) : NULL;
+    unlock_heap();
+    if (p == NULL)
+        errno = (alignment & (alignment - 1)) ? EINVAL : ENOMEM;
+    return p;
+}
+
+EXPORT void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)))
+        return EINVAL;
+    void *p = memalign(alignment, size);
+    if (p == NULL)
+        return ENOMEM;
+    *memptr = p;
+    return 0;
+}
+
+EXPORT void *valloc(size_t size)
+{
+    return memalign(mm_pagesize(), size);
+}
+
+EXPORT void *pvalloc(size_t size)
+{
+    size_t page = mm_pagesize();
+    /* rounding up to a page would wrap to 0 */
+    if (size > SIZE_MAX - (page - 1)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return memalign(page, (size + page - 1) / page * page);
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+    lock_heap();
+    size_t n = mm_malloc_usable_size(ptr);
+    unlock_heap();
+    return n;
+}
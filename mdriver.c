@@ -83,6 +83,7 @@ typedef struct {
     enum { ALLOC, FREE, REALLOC } type; /* type of request */
     long index;                         /* index for free() to use later */
     size_t size;                        /* byte size of alloc/realloc request */
+    int hint;                           /* MM_SHORT/LONG_LIVED for alloc, or 0 */
 } traceop_t;
 
 /* Holds the information for one trace file */
@@ -120,6 +121,8 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;       /* space utilization for this trace (always 0 for libc) */
+    size_t copied;     /* payload bytes mm_realloc copied during the util run */
+    bool hinted;       /* does the trace carry lifetime hints? */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -160,6 +163,12 @@ static int errors = 0;           /* number of errs found when running student ma
 static bool onetime_flag = false;
 static bool tab_mode = false;     /* Print output as tab-separated fields */
 static size_t maxfill = MAXFILL;
+static bool use_hints = true;     /* Pass lifetime hints on (cleared for -L) */
+
+/* With -i, blocks checked per operation in DBG_EXPENSIVE mode (0 = all),
+ * and the range the next round-robin check resumes from */
+static size_t check_budget = 0;
+static range_t *check_cursor = NULL;
 
 /* by default, no timeouts */
 static int set_timeout = 0;
@@ -181,6 +190,10 @@ static char **global_tracefiles = NULL;
 /* Summary statistics for libc and student's mm.c submissions */
 static sum_stats_t global_libc_sum_stats;
 static sum_stats_t global_mm_sum_stats;
+static sum_stats_t global_hardened_sum_stats;
+static sum_stats_t global_side_sum_stats;
+static sum_stats_t global_two_ended_sum_stats;
+static sum_stats_t global_adaptive_sum_stats;
 
 /* Performance statistics for driver */
 
@@ -206,6 +219,7 @@ static void randomize_block(trace_t *trace, int index);
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename);
+static int read_hint(FILE *tracefile);
 static void reinit_trace(trace_t *trace);
 static void free_trace(trace_t *trace);
 
@@ -218,9 +232,18 @@ static void eval_libc_speed(void *ptr);
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
 static double eval_mm_util(trace_t *trace, int tracenum);
 static void eval_mm_speed(void *ptr);
+static void run_compaction(int num_tracefiles, const char *tracedir,
+                           char **tracefiles);
+static void write_profile(const char *path, int num_tracefiles,
+                          const char *tracedir, char **tracefiles, int first_ops);
+static void run_prewarm(const char *profile, int num_tracefiles,
+                        const char *tracedir, char **tracefiles, int first_ops);
+static void run_background(unsigned period, int num_tracefiles,
+                           const char *tracedir, char **tracefiles);
 
 /* Various helper routines */
-static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printresults(int n, stats_t *stats, sum_stats_t *sumstats,
+                         bool show_copied);
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -241,6 +264,20 @@ static void timeout_handler(int sig __attribute__((unused))) {
 /* Compute throughput from reference implementation */
 static double measure_ref_throughput();
 
+/* Bytes mm_realloc has copied since the last mm_init */
+static size_t mm_copied_bytes(void) {
+    mm_stats_t s;
+    mm_get_stats(&s);
+    return s.realloc_copied;
+}
+
+/* mm_alloc - mm_malloc, or mm_malloc_hint for an ALLOC with a lifetime hint */
+static void *mm_alloc(const traceop_t *op) {
+    if (op->hint != 0 && use_hints)
+        return mm_malloc_hint(op->size, op->hint);
+    return mm_malloc(op->size);
+}
+
 /*
  * Run the tests; return the number of tests run (may be less than
  * num_tracefiles, if there's a timeout)
@@ -254,12 +291,13 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         /* initialize simulated memory system in memlib.c *
          * start each trace with a clean system */
         mem_init();
-        range_set_t *ranges = new_range_set();
+        /* volatile: the timeout siglongjmps back into this frame */
+        range_set_t *volatile ranges = new_range_set();
 
 
         // NOTE: If times out, then it will reread the trace file 
 
-        trace_t *trace;
+        trace_t *volatile trace;
         trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
         strcpy(mm_stats[i].filename, trace->filename);
         mm_stats[i].ops = trace->num_ops;
@@ -286,6 +324,7 @@ static void run_tests(int num_tracefiles, const char *tracedir,
             if (verbose > 1)
                 printf("efficiency, ");
             mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].copied = mm_copied_bytes();
             speed_params->trace = trace;
             if (verbose > 1)
                 printf("and performance.\n");
@@ -330,6 +369,21 @@ int main(int argc, char **argv)
     speed_t speed_params;      /* input parameters to the xx_speed routines */
 
     bool run_libc = false;     /* If set, run libc malloc (set by -l) */
+    bool run_hardened = false; /* If set, rerun mm in hardened mode (set by -H) */
+    bool run_compact = false;  /* If set, replay with handles and mm_compact (set by -C) */
+    bool run_side = false;     /* If set, rerun mm with the side table layout (set by -M) */
+    bool run_two_ended = false; /* If set, rerun mm with a two-ended heap (set by -E) */
+    stats_t *side_stats = NULL; /* mm stats with the side table layout */
+    stats_t *two_ended_stats = NULL; /* mm stats with a two-ended heap */
+    bool run_adaptive = false; /* If set, rerun mm with adaptive size classes (set by -A) */
+    stats_t *adaptive_stats = NULL; /* mm stats with adaptive size classes */
+    char *profile_out = NULL;  /* size profile to write (set by -G) */
+    char *profile_in = NULL;   /* size profile to pre-warm with (set by -W) */
+    int first_ops = 10000;     /* startup window for -G and -W (set by -N) */
+    bool run_unhinted = false; /* If set, rerun mm without lifetime hints (set by -L) */
+    unsigned background = 0;   /* maintenance thread period to compare, us (set by -B) */
+    stats_t *unhinted_stats = NULL; /* mm stats with the hints dropped */
+    stats_t *hardened_stats = NULL; /* mm stats in hardened mode */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util;
@@ -359,7 +413,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hOVlDT")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:i:P:G:W:N:B:hOVlDTHCMELA")) != EOF) {
         switch (c) {
 
             case 'f': /* Use one specific trace file only (relative to curr dir) */
@@ -385,6 +439,63 @@ int main(int argc, char **argv)
                 run_libc = true;
                 break;
 
+            case 'H': /* Rerun mm malloc in hardened mode */
+                run_hardened = true;
+                break;
+
+            case 'C': /* Replay the traces through handles and mm_compact */
+                run_compact = true;
+                break;
+
+            case 'M': /* Rerun mm malloc with block metadata in a side table */
+                run_side = true;
+                break;
+
+            case 'E': /* Rerun mm malloc with large blocks at the heap top */
+                run_two_ended = true;
+                break;
+
+            case 'A': /* Rerun mm malloc with adaptive size classes */
+                run_adaptive = true;
+                break;
+
+            case 'L': /* Rerun mm malloc with the traces' lifetime hints dropped */
+                run_unhinted = true;
+                break;
+
+            case 'G': /* Write a size profile of the traces' first ops */
+                profile_out = strdup(optarg);
+                break;
+
+            case 'W': /* Time the first ops with the heap pre-warmed by a profile */
+                profile_in = strdup(optarg);
+                break;
+
+            case 'N': /* Number of first ops for -G and -W */
+                first_ops = atoi(optarg);
+                if (first_ops <= 0) {
+                    fprintf(stderr, "Bad op count %s\n", optarg);
+                    exit(1);
+                }
+                break;
+
+            case 'B': /* Per-op latency with maintenance inline and on a thread */
+                background = atoi(optarg);
+                if (background == 0) {
+                    fprintf(stderr, "Bad maintenance period %s\n", optarg);
+                    exit(1);
+                }
+                break;
+
+            case 'P': { /* Speed/space policy thresholds, lo:hi percent */
+                unsigned lo, hi;
+                if (sscanf(optarg, "%u:%u", &lo, &hi) != 2 || !mm_set_policy(lo, hi)) {
+                    fprintf(stderr, "Bad policy thresholds %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            }
+
             case 'V': /* Increase verbosity level */
                 verbose += 1;
                 break;
@@ -401,6 +512,11 @@ int main(int argc, char **argv)
                 debug_mode = DBG_EXPENSIVE;
                 break;
 
+            case 'i': /* Incremental checking: bound the work per operation */
+                check_budget = atoi(optarg);
+                mm_set_check_budget(check_budget);
+                break;
+
             case 's':
                 set_timeout = atoi(optarg);
                 break;
@@ -467,7 +583,7 @@ int main(int argc, char **argv)
            summary statistics */
         if (verbose) {
             printf("\nResults for libc malloc:\n");
-            printresults(num_global_tracefiles, libc_stats, &global_libc_sum_stats);
+            printresults(num_global_tracefiles, libc_stats, &global_libc_sum_stats, false);
         }
     }
 
@@ -518,7 +634,7 @@ int main(int argc, char **argv)
             }
         } else {
             printf("\nResults for mm malloc:\n");
-            printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats);
+            printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats, true);
             printf("\n");
         }
     }
@@ -530,6 +646,183 @@ int main(int argc, char **argv)
                (float)(global_mm_sum_stats.tput/global_libc_sum_stats.tput));
     }
 
+    /*
+     * Optionally rerun the mm package in hardened mode and report what
+     * the checks cost relative to the plain run above
+     */
+    if (run_hardened && !onetime_flag) {
+        if (verbose > 1)
+            printf("\nTesting mm malloc in hardened mode\n");
+
+        hardened_stats = (stats_t *)calloc(num_global_tracefiles, sizeof(stats_t));
+        if (hardened_stats == NULL)
+            unix_error("hardened_stats calloc in main failed");
+
+        mm_set_hardened(true);
+        run_tests(num_global_tracefiles, tracedir, global_tracefiles,
+                  hardened_stats, &speed_params);
+        mm_set_hardened(false);
+
+        if (verbose) {
+            printf("\nResults for mm malloc (hardened):\n");
+            printresults(num_global_tracefiles, hardened_stats,
+                         &global_hardened_sum_stats, true);
+            printf("\n");
+        }
+        printf("Hardened mode cost: plain/hardened = %.0f Kops / %.0f Kops = %.3f\n",
+               (float)global_mm_sum_stats.tput, (float)global_hardened_sum_stats.tput,
+               (float)(global_mm_sum_stats.tput/global_hardened_sum_stats.tput));
+        free(hardened_stats);
+    }
+
+    /*
+     * Optionally rerun the mm package with the side table layout and
+     * compare it with the inline-header run above
+     */
+    if (run_side && !onetime_flag) {
+        if (verbose > 1)
+            printf("\nTesting mm malloc with the side table layout\n");
+
+        side_stats = (stats_t *)calloc(num_global_tracefiles, sizeof(stats_t));
+        if (side_stats == NULL)
+            unix_error("side_stats calloc in main failed");
+
+        mm_set_side_table(true);
+        run_tests(num_global_tracefiles, tracedir, global_tracefiles,
+                  side_stats, &speed_params);
+        mm_set_side_table(false);
+
+        if (verbose) {
+            printf("\nResults for mm malloc (side table):\n");
+            printresults(num_global_tracefiles, side_stats,
+                         &global_side_sum_stats, true);
+            printf("\n");
+        }
+        printf("Side table layout: inline/side = %.0f Kops / %.0f Kops = %.3f\n",
+               (float)global_mm_sum_stats.tput, (float)global_side_sum_stats.tput,
+               (float)(global_mm_sum_stats.tput/global_side_sum_stats.tput));
+        free(side_stats);
+    }
+
+    /*
+     * Optionally rerun the mm package with a two-ended heap, large blocks
+     * growing down from the top, and compare utilization and throughput
+     */
+    if (run_two_ended && !onetime_flag) {
+        if (verbose > 1)
+            printf("\nTesting mm malloc with a two-ended heap\n");
+
+        two_ended_stats = (stats_t *)calloc(num_global_tracefiles, sizeof(stats_t));
+        if (two_ended_stats == NULL)
+            unix_error("two_ended_stats calloc in main failed");
+
+        mm_set_two_ended(true);
+        run_tests(num_global_tracefiles, tracedir, global_tracefiles,
+                  two_ended_stats, &speed_params);
+        mm_set_two_ended(false);
+
+        if (verbose) {
+            printf("\nResults for mm malloc (two-ended heap):\n");
+            printresults(num_global_tracefiles, two_ended_stats,
+                         &global_two_ended_sum_stats, true);
+            printf("\n");
+        }
+        printf("Two-ended heap: util %.1f%% -> %.1f%%, %.0f Kops -> %.0f Kops\n",
+               global_mm_sum_stats.util, global_two_ended_sum_stats.util,
+               (float)global_mm_sum_stats.tput, (float)global_two_ended_sum_stats.tput);
+        free(two_ended_stats);
+    }
+
+    /*
+     * Optionally rerun the mm package with size classes drawn from the
+     * request sizes, and compare utilization and throughput
+     */
+    if (run_adaptive && !onetime_flag) {
+        if (verbose > 1)
+            printf("\nTesting mm malloc with adaptive size classes\n");
+
+        adaptive_stats = (stats_t *)calloc(num_global_tracefiles, sizeof(stats_t));
+        if (adaptive_stats == NULL)
+            unix_error("adaptive_stats calloc in main failed");
+
+        mm_set_adaptive_classes(true);
+        run_tests(num_global_tracefiles, tracedir, global_tracefiles,
+                  adaptive_stats, &speed_params);
+        mm_set_adaptive_classes(false);
+
+        if (verbose) {
+            printf("\nResults for mm malloc (adaptive size classes):\n");
+            printresults(num_global_tracefiles, adaptive_stats,
+                         &global_adaptive_sum_stats, true);
+            printf("\n");
+        }
+        printf("Adaptive size classes: util %.1f%% -> %.1f%%, %.0f Kops -> %.0f Kops\n",
+               global_mm_sum_stats.util, global_adaptive_sum_stats.util,
+               (float)global_mm_sum_stats.tput, (float)global_adaptive_sum_stats.tput);
+        /* unscored traces such as syn-hotsize are left out of the sums */
+        for (i = 0; i < num_global_tracefiles; i++) {
+            if (mm_stats[i].weight != WNONE || !mm_stats[i].valid || !adaptive_stats[i].valid)
+                continue;
+            printf("  util %.1f%% -> %.1f%%, %.0f Kops -> %.0f Kops  %s\n",
+                   mm_stats[i].util * 100.0, adaptive_stats[i].util * 100.0,
+                   mm_stats[i].ops / mm_stats[i].secs / 1e3,
+                   adaptive_stats[i].ops / adaptive_stats[i].secs / 1e3,
+                   mm_stats[i].filename);
+        }
+        free(adaptive_stats);
+    }
+
+    /*
+     * Optionally rerun the mm package with every ALLOC going to plain
+     * mm_malloc, and compare utilization on the traces that carry hints
+     */
+    if (run_unhinted && !onetime_flag) {
+        if (verbose > 1)
+            printf("\nTesting mm malloc without lifetime hints\n");
+
+        unhinted_stats = (stats_t *)calloc(num_global_tracefiles, sizeof(stats_t));
+        if (unhinted_stats == NULL)
+            unix_error("unhinted_stats calloc in main failed");
+
+        use_hints = false;
+        run_tests(num_global_tracefiles, tracedir, global_tracefiles,
+                  unhinted_stats, &speed_params);
+        use_hints = true;
+
+        printf("\nLifetime hints: util with / without hints\n");
+        for (i = 0; i < num_global_tracefiles; i++) {
+            if (!mm_stats[i].hinted)
+                continue;
+            if (mm_stats[i].valid && unhinted_stats[i].valid)
+                printf("  %6.1f%% / %6.1f%%  %s\n", mm_stats[i].util * 100.0,
+                       unhinted_stats[i].util * 100.0, mm_stats[i].filename);
+            else
+                printf("  %7s / %7s  %s\n", "-", "-", mm_stats[i].filename);
+        }
+        free(unhinted_stats);
+    }
+
+    /* Optionally report what compaction recovers on handle allocations */
+    if (run_compact && !onetime_flag) {
+        run_compaction(num_global_tracefiles, tracedir, global_tracefiles);
+    }
+
+    /* Optionally profile the traces' startup, and time it pre-warmed */
+    if (profile_out != NULL) {
+        write_profile(profile_out, num_global_tracefiles, tracedir,
+                      global_tracefiles, first_ops);
+    }
+    if (profile_in != NULL) {
+        run_prewarm(profile_in, num_global_tracefiles, tracedir,
+                    global_tracefiles, first_ops);
+    }
+
+    /* Optionally compare op latency with the maintenance thread */
+    if (background != 0 && !onetime_flag) {
+        run_background(background, num_global_tracefiles, tracedir,
+                       global_tracefiles);
+    }
+
     /*
      * Accumulate the aggregate statistics for the student's mm package
      */
@@ -715,12 +1008,15 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
         return false;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within one of the heap's two regions: the
+       bottom one grown by mm_sbrk, or the top one grown down by mm_sbrk_top */
+    bool in_bottom = lo >= (char *)mem_heap_lo() && hi <= (char *)mem_heap_hi();
+    bool in_top = lo >= (char *)mem_top_lo() && hi <= (char *)mem_top_hi();
+    if (lo > hi || (!in_bottom && !in_top)) {
         malloc_error(trace, opnum,
-                     "Payload (%p:%p) lies outside heap (%p:%p)",
-                     lo, hi, mem_heap_lo(), mem_heap_hi());
+                     "Payload (%p:%p) lies outside heap (%p:%p, %p:%p)",
+                     lo, hi, mem_heap_lo(), mem_heap_hi(),
+                     mem_top_lo(), mem_top_hi());
         return false;
     }
 
@@ -776,6 +1072,8 @@ static void remove_range(range_set_t *ranges, char *lo)
         return;
     range_t *prev = p->prev;
     range_t *next = p->next;
+    if (p == check_cursor)
+        check_cursor = next;
     if (prev)
         prev->next = next;
     else
@@ -793,6 +1091,7 @@ static void reset_range_set(range_set_t *ranges)
     tree_free(ranges->lo_tree, free);
     ranges->lo_tree = tree_new();
     ranges->list = NULL;
+    check_cursor = NULL;
 }
 
 /*
@@ -802,6 +1101,7 @@ static void free_range_set(range_set_t *ranges)
 {
     tree_free(ranges->lo_tree, free);
     free(ranges);
+    check_cursor = NULL;
 }
 
 /**********************************************
@@ -940,6 +1240,7 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     int max_index = 0;
     int op_index;
     int ignore = 0;
+    bool hinted = false;
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
@@ -996,6 +1297,8 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
                 trace->ops[op_index].type = ALLOC;
                 trace->ops[op_index].index = index;
                 trace->ops[op_index].size = size;
+                trace->ops[op_index].hint = read_hint(tracefile);
+                hinted |= trace->ops[op_index].hint != 0;
                 max_index = (index > max_index) ? index : max_index;
                 break;
             case 'r':
@@ -1003,12 +1306,14 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
                 trace->ops[op_index].type = REALLOC;
                 trace->ops[op_index].index = index;
                 trace->ops[op_index].size = size;
+                trace->ops[op_index].hint = 0;
                 max_index = (index > max_index) ? index : max_index;
                 break;
             case 'f':
                 ignore += fscanf(tracefile, "%u", &index);
                 trace->ops[op_index].type = FREE;
                 trace->ops[op_index].index = index;
+                trace->ops[op_index].hint = 0;
                 break;
             default:
                 app_error("Bogus type character (%c) in tracefile %s\n",
@@ -1025,10 +1330,29 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     strcpy(stats->filename, trace->filename);
     stats->weight = trace->weight;
     stats->ops = trace->num_ops;
+    stats->hinted = hinted;
 
     return trace;
 }
 
+/*
+ * read_hint - reads the optional lifetime hint that may follow an alloc
+ *     request's size: 's' for short-lived, 'l' for long-lived.
+ */
+static int read_hint(FILE *tracefile)
+{
+    int c;
+    while ((c = getc(tracefile)) == ' ' || c == '\t')
+        ;
+    if (c == 's')
+        return MM_SHORT_LIVED;
+    if (c == 'l')
+        return MM_LONG_LIVED;
+    if (c != EOF)
+        ungetc(c, tracefile);
+    return 0;
+}
+
 /*
  * reinit_trace - get the trace ready for another run.
  */
@@ -1094,12 +1418,24 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
                 return false;
             };
 
-            /* Now check that all our allocated blocks have the right data */
-            r = ranges->list;
-            while (r) {
-                if (!check_index(trace, i, r->index, 0))
-                    return false;
-                r = r->next;
+            /* Now check that all our allocated blocks have the right data,
+             * or with -i only the next check_budget of them */
+            if (check_budget == 0) {
+                r = ranges->list;
+                while (r) {
+                    if (!check_index(trace, i, r->index, 0))
+                        return false;
+                    r = r->next;
+                }
+            } else {
+                size_t n;
+                for (n = 0; n < check_budget && ranges->list; n++) {
+                    if (check_cursor == NULL)
+                        check_cursor = ranges->list;
+                    if (!check_index(trace, i, check_cursor->index, 0))
+                        return false;
+                    check_cursor = check_cursor->next;
+                }
             }
         }
 
@@ -1108,7 +1444,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             case ALLOC: /* mm_malloc */
 
                 /* Call the student's malloc */
-                if ((p = mm_malloc(size)) == NULL) {
+                if ((p = mm_alloc(&trace->ops[i])) == NULL) {
                     malloc_error(trace, i, "mm_malloc failed.");
                     return false;
                 }
@@ -1232,7 +1568,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 index = trace->ops[i].index;
                 size = trace->ops[i].size;
 
-                if ((p = mm_malloc(size)) == NULL) {
+                if ((p = mm_alloc(&trace->ops[i])) == NULL) {
                     app_error("trace %d: mm_malloc failed in eval_mm_util",
                               tracenum);
                 }
@@ -1298,6 +1634,457 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 }
 
 
+/* Summarizes one trace replayed through handles by eval_mm_compact */
+typedef struct {
+    bool valid;          /* payloads survived every compaction */
+    double frag_before;  /* mean free share of the heap before mm_compact */
+    double frag_after;   /* ... and after it */
+    size_t recovered;    /* heap bytes given back, summed over the calls */
+    size_t moved;        /* bytes mm_compact slid down */
+    double usecs_per_mb; /* compaction time per MB of live payload */
+} compact_stats_t;
+
+#define COMPACT_POINTS 8 /* mm_compact calls spread evenly over a trace */
+
+/*
+ * Mark the first, middle and last payload byte with a byte derived from
+ * the id, as a move check; whole payloads would be too much to touch for
+ * the largemem traces
+ */
+static void compact_fill(mm_handle_t h, int index, size_t size) {
+    unsigned char *p = mm_hderef(h);
+    p[0] = p[size / 2] = p[size - 1] = index & 0xFF;
+}
+
+static bool compact_intact(mm_handle_t h, int index, size_t size) {
+    unsigned char *p = mm_hderef(h);
+    unsigned char b = index & 0xFF;
+    return size == 0 || (p[0] == b && p[size / 2] == b && p[size - 1] == b);
+}
+
+/*
+ * eval_mm_compact - replay a trace with mm_halloc/mm_hfree instead of
+ *   malloc/free and call mm_compact at COMPACT_POINTS evenly spaced
+ *   operations. Fragmentation is the share of the heap outside allocated
+ *   blocks, i.e. external fragmentation. A realloc becomes allocate, fill,
+ *   free: no payload is copied, since the marks only depend on the id.
+ */
+static compact_stats_t eval_mm_compact(trace_t *trace) {
+    compact_stats_t cs = { .valid = true };
+    mm_handle_t *handles = calloc(trace->num_ids, sizeof(mm_handle_t));
+    size_t *sizes = calloc(trace->num_ids, sizeof(size_t));
+    size_t live = 0;
+    double secs = 0, live_mb = 0;
+    int every = trace->num_ops / COMPACT_POINTS;
+    int points = 0;
+    int i, j;
+
+    if (handles == NULL || sizes == NULL)
+        unix_error("eval_mm_compact calloc failed");
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_compact");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        int index = trace->ops[i].index;
+        size_t size = trace->ops[i].size;
+        mm_handle_t h;
+
+        switch (trace->ops[i].type) {
+        case ALLOC:
+        case REALLOC:
+            h = size ? mm_halloc(size) : 0;
+            if (size && h == 0)
+                app_error("mm_halloc failed in eval_mm_compact");
+            if (h != 0) {
+                compact_fill(h, index, size);
+            }
+            if (trace->ops[i].type == REALLOC && handles[index] != 0) {
+                mm_hfree(handles[index]);
+                live -= sizes[index];
+            }
+            handles[index] = h;
+            sizes[index] = size;
+            live += size;
+            break;
+        case FREE:
+            if (index >= 0 && handles[index] != 0) {
+                mm_hfree(handles[index]);
+                live -= sizes[index];
+                handles[index] = 0;
+            }
+            break;
+        default:
+            app_error("Nonexistent request type in eval_mm_compact");
+        }
+
+        if (every == 0 || (i + 1) % every != 0 || points == COMPACT_POINTS)
+            continue;
+
+        mm_stats_t s;
+        mm_get_stats(&s);
+        size_t before = s.heap_bytes;
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        cs.moved += mm_compact();
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        size_t after = mem_heapsize();
+
+        secs += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+        live_mb += live / (1024.0 * 1024.0);
+        /* an empty heap is not fragmented, whatever its size */
+        if (s.alloc_bytes > 0) {
+            cs.frag_before += 1.0 - (double)s.alloc_bytes / before;
+            cs.frag_after += 1.0 - (double)s.alloc_bytes / after;
+        }
+        cs.recovered += before - after;
+        points++;
+
+        for (j = 0; j < trace->num_ids; j++) {
+            if (handles[j] != 0 && !compact_intact(handles[j], j, sizes[j]))
+                cs.valid = false;
+        }
+        if (!mm_checkheap(__LINE__))
+            cs.valid = false;
+    }
+
+    if (points > 0) {
+        cs.frag_before /= points;
+        cs.frag_after /= points;
+    }
+    cs.usecs_per_mb = live_mb > 0 ? secs * 1e6 / live_mb : 0;
+    free(handles);
+    free(sizes);
+    return cs;
+}
+
+/*
+ * run_compaction - replay every trace through handles and print what
+ *   mm_compact recovered and what it cost
+ */
+static void run_compaction(int num_tracefiles, const char *tracedir,
+                           char **tracefiles) {
+    stats_t unused;
+    double frag_before = 0, frag_after = 0, usecs = 0;
+    int i;
+
+    printf("\nCompaction (handles, mm_compact every 1/%d of each trace):\n",
+           COMPACT_POINTS);
+    printf("%5s %11s %10s %12s %10s %12s  %s\n", "valid", "frag before",
+           "frag after", "recovered KB", "moved KB", "usec/live MB", "trace");
+    for (i = 0; i < num_tracefiles; i++) {
+        mem_init();
+        trace_t *trace = read_trace(&unused, tracedir, tracefiles[i]);
+        compact_stats_t cs = eval_mm_compact(trace);
+        printf("%5s %10.1f%% %9.1f%% %12.1f %10.1f %12.1f  %s\n",
+               cs.valid ? "yes" : "no", cs.frag_before * 100.0,
+               cs.frag_after * 100.0, cs.recovered / 1024.0,
+               cs.moved / 1024.0, cs.usecs_per_mb, trace->filename);
+        frag_before += cs.frag_before;
+        frag_after += cs.frag_after;
+        usecs += cs.usecs_per_mb;
+        if (!cs.valid)
+            errors++;
+        free_trace(trace);
+        mem_deinit();
+    }
+    printf("%5s %10.1f%% %9.1f%% %12s %10s %12.1f\n", "mean",
+           frag_before * 100.0 / num_tracefiles,
+           frag_after * 100.0 / num_tracefiles, "", "",
+           usecs / num_tracefiles);
+}
+
+/*
+ * write_profile - for each request size, the most blocks of that size the
+ *   first first_ops ops of any trace hold at once. The sizes with the most
+ *   bytes at their peak, up to PROFILE_SIZES of them, go to path in the
+ *   format mm_set_profile reads.
+ */
+#define PROFILE_SIZES 64
+
+typedef struct {
+    size_t size;
+    long live;
+    long peak;
+} size_count_t;
+
+static int by_size(const void *a, const void *b) {
+    size_t x = ((const size_count_t *)a)->size, y = ((const size_count_t *)b)->size;
+    return x < y ? -1 : x > y;
+}
+
+static int by_peak_bytes(const void *a, const void *b) {
+    const size_count_t *x = a, *y = b;
+    double bx = (double)x->size * x->peak, by = (double)y->size * y->peak;
+    return bx > by ? -1 : bx < by;
+}
+
+/* the entry for size in the sorted counts[0..*n), added if missing */
+static size_count_t *size_count(size_count_t *counts, int *n, size_t size) {
+    int lo = 0, hi = *n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (counts[mid].size < size)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == *n || counts[lo].size != size) {
+        memmove(&counts[lo + 1], &counts[lo], (*n - lo) * sizeof(*counts));
+        counts[lo].size = size;
+        counts[lo].live = counts[lo].peak = 0;
+        (*n)++;
+    }
+    return &counts[lo];
+}
+
+static void write_profile(const char *path, int num_tracefiles,
+                          const char *tracedir, char **tracefiles, int first_ops) {
+    stats_t unused;
+    size_count_t *all = NULL;
+    int nall = 0, t, i;
+
+    for (t = 0; t < num_tracefiles; t++) {
+        trace_t *trace = read_trace(&unused, tracedir, tracefiles[t]);
+        int nops = trace->num_ops < first_ops ? trace->num_ops : first_ops;
+        size_count_t *counts = calloc(nops + 1, sizeof(*counts));
+        size_t *sizes = calloc(trace->num_ids, sizeof(*sizes));
+        int n = 0;
+        if (counts == NULL || sizes == NULL)
+            unix_error("write_profile calloc failed");
+
+        for (i = 0; i < nops; i++) {
+            traceop_t *op = &trace->ops[i];
+            if (op->index < 0)
+                continue;
+            if (op->type != ALLOC && sizes[op->index] != 0)
+                size_count(counts, &n, sizes[op->index])->live--;
+            sizes[op->index] = op->type == FREE ? 0 : op->size;
+            if (op->type != FREE && op->size != 0) {
+                size_count_t *c = size_count(counts, &n, op->size);
+                if (++c->live > c->peak)
+                    c->peak = c->live;
+            }
+        }
+
+        /* a size's count is its peak in whichever trace needs the most */
+        all = realloc(all, (nall + n) * sizeof(*all));
+        if (all == NULL && nall + n > 0)
+            unix_error("write_profile realloc failed");
+        for (i = 0; i < n; i++) {
+            size_count_t *c = size_count(all, &nall, counts[i].size);
+            if (counts[i].peak > c->peak)
+                c->peak = counts[i].peak;
+        }
+        free(counts);
+        free(sizes);
+        free_trace(trace);
+    }
+
+    qsort(all, nall, sizeof(*all), by_peak_bytes);
+    if (nall > PROFILE_SIZES)
+        nall = PROFILE_SIZES;
+    qsort(all, nall, sizeof(*all), by_size);
+
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        unix_error("Couldn't write profile %s", path);
+    fprintf(f, "# mm size profile: peak live blocks per request size\n");
+    fprintf(f, "# over the first %d ops of %d trace(s)\n", first_ops, num_tracefiles);
+    for (i = 0; i < nall; i++)
+        fprintf(f, "%zu %ld\n", all[i].size, all[i].peak);
+    fclose(f);
+    printf("Wrote a size profile of %d sizes to %s\n", nall, path);
+    free(all);
+}
+
+/*
+ * replay_ops - run ops [from, to) of a trace on mm, keeping trace->blocks
+ *   to the blocks that are live
+ */
+static void replay_ops(trace_t *trace, int from, int to) {
+    int i;
+    for (i = from; i < to; i++) {
+        traceop_t *op = &trace->ops[i];
+        char *p;
+        switch (op->type) {
+        case ALLOC:
+            if ((p = mm_alloc(op)) == NULL)
+                app_error("mm_malloc failed in replay_ops");
+            trace->blocks[op->index] = p;
+            break;
+        case REALLOC:
+            p = mm_realloc(trace->blocks[op->index], op->size);
+            if (p == NULL && op->size != 0)
+                app_error("mm_realloc failed in replay_ops");
+            trace->blocks[op->index] = p;
+            break;
+        case FREE:
+            if (op->index >= 0) {
+                mm_free(trace->blocks[op->index]);
+                trace->blocks[op->index] = NULL;
+            }
+            break;
+        default:
+            app_error("Nonexistent request type in replay_ops");
+        }
+    }
+}
+
+#define PREWARM_REPS 5 /* the fastest of this many runs counts */
+
+/*
+ * time_first_ops - seconds for the first nops ops on a fresh heap, not
+ *   counting mm_init; with steady, on a heap that has already run the
+ *   whole trace and freed what it held
+ */
+static double time_first_ops(trace_t *trace, int nops, bool steady) {
+    double best = DBL_MAX;
+    int r, i;
+    for (r = 0; r < PREWARM_REPS; r++) {
+        struct timespec t0, t1;
+        reinit_trace(trace);
+        mem_reset_brk();
+        if (!mm_init())
+            app_error("mm_init failed in time_first_ops");
+        if (steady) {
+            replay_ops(trace, 0, trace->num_ops);
+            for (i = 0; i < trace->num_ids; i++) {
+                mm_free(trace->blocks[i]);
+                trace->blocks[i] = NULL;
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        replay_ops(trace, 0, nops);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+        if (secs < best)
+            best = secs;
+    }
+    return best;
+}
+
+/*
+ * run_prewarm - time each trace's first ops from a cold heap, from one
+ *   pre-warmed with the profile, and in steady state
+ */
+static void run_prewarm(const char *profile, int num_tracefiles,
+                        const char *tracedir, char **tracefiles, int first_ops) {
+    stats_t unused;
+    mm_stats_t s;
+    int i;
+
+    printf("\nFirst %d ops, ns/op (pre-warmed with %s):\n", first_ops, profile);
+    printf("%8s %8s %8s %10s  %s\n", "cold", "warm", "steady", "warm KB", "trace");
+    for (i = 0; i < num_tracefiles; i++) {
+        mem_init();
+        trace_t *trace = read_trace(&unused, tracedir, tracefiles[i]);
+        int nops = trace->num_ops < first_ops ? trace->num_ops : first_ops;
+
+        double cold = time_first_ops(trace, nops, false);
+        double steady = time_first_ops(trace, nops, true);
+        if (!mm_set_profile(profile))
+            app_error("Couldn't read size profile %s", profile);
+        double warm = time_first_ops(trace, nops, false);
+        mm_get_stats(&s);
+        mm_set_profile(NULL);
+
+        printf("%8.1f %8.1f %8.1f %10.1f  %s\n", cold * 1e9 / nops,
+               warm * 1e9 / nops, steady * 1e9 / nops,
+               s.prewarm_bytes / 1024.0, trace->filename);
+        free_trace(trace);
+        mem_deinit();
+    }
+}
+
+#define BACKGROUND_REPS 3 /* latencies of this many runs are pooled */
+
+static int by_latency(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * time_each_op - run the whole trace BACKGROUND_REPS times on a fresh
+ *   heap, with the maintenance thread every period us (0: inline), and
+ *   sort the ns each op took into lat; returns the peak heap size
+ */
+static size_t time_each_op(trace_t *trace, unsigned period, long *lat) {
+    size_t peak = 0;
+    mm_stats_t s;
+    int r, i;
+    for (r = 0; r < BACKGROUND_REPS; r++) {
+        reinit_trace(trace);
+        mem_reset_brk();
+        mm_set_background(period);
+        if (!mm_init())
+            app_error("mm_init failed in time_each_op");
+        for (i = 0; i < trace->num_ops; i++) {
+            struct timespec t0, t1;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            replay_ops(trace, i, i + 1);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            lat[r * trace->num_ops + i] =
+                (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec);
+            mm_get_stats(&s);
+            if (s.heap_bytes > peak)
+                peak = s.heap_bytes;
+        }
+        /* the thread has to be gone before the next mem_reset_brk */
+        mm_set_background(0);
+    }
+    qsort(lat, (size_t)BACKGROUND_REPS * trace->num_ops, sizeof(long), by_latency);
+    return peak;
+}
+
+/*
+ * run_background - per-op latency percentiles and peak heap for each
+ *   trace with maintenance inline and on a thread woken every period us,
+ *   after checking the trace with the thread running (with -D, the heap
+ *   checker runs against the thread too)
+ */
+static void run_background(unsigned period, int num_tracefiles,
+                           const char *tracedir, char **tracefiles) {
+    static const double pcts[3] = { 0.5, 0.99, 0.999 };
+    stats_t unused;
+    int i, k;
+
+    printf("\nMaintenance thread every %u us: ns/op and peak heap, inline / background\n",
+           period);
+    printf("%5s %17s %17s %17s %19s  %s\n", "valid", "p50", "p99", "p99.9",
+           "peak heap KB", "trace");
+    for (i = 0; i < num_tracefiles; i++) {
+        mem_init();
+        range_set_t *ranges = new_range_set();
+        trace_t *trace = read_trace(&unused, tracedir, tracefiles[i]);
+        size_t n = (size_t)BACKGROUND_REPS * trace->num_ops;
+        long *inline_lat = malloc(n * sizeof(long));
+        long *bg_lat = malloc(n * sizeof(long));
+        if (inline_lat == NULL || bg_lat == NULL)
+            unix_error("run_background malloc failed");
+
+        mm_set_background(period);
+        bool valid = eval_mm_valid(trace, ranges);
+        mm_set_background(0);
+        if (!valid)
+            errors++;
+        size_t inline_peak = time_each_op(trace, 0, inline_lat);
+        size_t bg_peak = time_each_op(trace, period, bg_lat);
+
+        printf("%5s", valid ? "yes" : "no");
+        for (k = 0; k < 3; k++)
+            printf(" %8ld / %-6ld", inline_lat[(size_t)(pcts[k] * (n - 1))],
+                   bg_lat[(size_t)(pcts[k] * (n - 1))]);
+        printf(" %9.0f / %-7.0f  %s\n", inline_peak / 1024.0, bg_peak / 1024.0,
+               trace->filename);
+        free(inline_lat);
+        free(bg_lat);
+        free_trace(trace);
+        free_range_set(ranges);
+        mem_deinit();
+    }
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
@@ -1305,7 +2092,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 static void eval_mm_speed(void *ptr)
 {
     int i, index;
-    size_t size, newsize;
+    size_t newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
     reinit_trace(trace);
@@ -1321,8 +2108,7 @@ static void eval_mm_speed(void *ptr)
 
             case ALLOC: /* mm_malloc */
                 index = trace->ops[i].index;
-                size = trace->ops[i].size;
-                if ((p = mm_malloc(size)) == NULL)
+                if ((p = mm_alloc(&trace->ops[i])) == NULL)
                     app_error("mm_malloc error in eval_mm_speed");
                 trace->blocks[index] = p;
                 break;
@@ -1459,7 +2245,8 @@ static void eval_libc_speed(void *ptr)
  * printresults - prints a performance summary for some malloc package and returns
  *                a summary of the stats to the caller. 
  */
-static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
+static void printresults(int n, stats_t *stats, sum_stats_t *sumstats,
+                         bool show_copied)
 {
     int i;
 
@@ -1477,8 +2264,8 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     if (tab_mode) {
         printf("valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\ttrace\n");
     } else {
-        printf("  %5s  %6s %7s%8s%8s  %s\n",
-               "valid", "util", "ops", "msecs", "Kops", "trace");
+        printf("  %5s  %6s %7s%8s%8s %9s  %s\n",
+               "valid", "util", "ops", "msecs", "Kops", "Kcopied", "trace");
     }
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
@@ -1541,6 +2328,14 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                     printf("%8s%10s%7s ", "--", "--", "--");
             }
 
+            /* Bytes copied by realloc, in KB */
+            if (!tab_mode) {
+                if (show_copied)
+                    printf("%9.1f ", stats[i].copied / 1024.0);
+                else
+                    printf("%9s ", "--");
+            }
+
             printf("%s\n", stats[i].filename);
 
             if (stats[i].weight == WALL || stats[i].weight == WPERF)
@@ -1559,13 +2354,14 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
             if (tab_mode) {
                 printf("no\t\t\t\t\t\t\t%s\n", stats[i].filename);
             } else {
-                printf("%2s%4s%7s%10s%7s%10s %s\n",
+                printf("%2s%4s%7s%10s%7s%10s%10s %s\n",
                        stats[i].weight != 0 ? "*" : "",
                        "no",
                        "-",
                        "-",
                        "-",
                        "-",
+                       "-",
                        stats[i].filename);
             }
         }
@@ -1831,14 +2627,26 @@ static double measure_ref_throughput() {
  */
 static void usage(char *prog)
 {
-    fprintf(stderr, "Usage: %s [-hlVdD] [-f <file>]\n", prog);
+    fprintf(stderr, "Usage: %s [-hlHMEALCVdD] [-P <lo:hi>] [-G|-W <profile>] [-N <n>] [-B <us>] [-f <file>]\n", prog);
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
     fprintf(stderr, "\t-D         Equivalent to -d2.\n");
+    fprintf(stderr, "\t-i <n>     With -D, check only n blocks per operation.\n");
     fprintf(stderr, "\t-c <file>  Run trace file <file> once, check for correctness only.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-H         Rerun mm malloc in hardened mode and report its cost.\n");
+    fprintf(stderr, "\t-M         Rerun mm malloc with the side table layout and compare.\n");
+    fprintf(stderr, "\t-E         Rerun mm malloc with a two-ended heap and compare.\n");
+    fprintf(stderr, "\t-A         Rerun mm malloc with adaptive size classes and compare.\n");
+    fprintf(stderr, "\t-L         Rerun mm malloc ignoring lifetime hints and compare.\n");
+    fprintf(stderr, "\t-P <lo:hi> Speed mode below lo%% of the heap live, space mode from hi%%.\n");
+    fprintf(stderr, "\t-G <file>  Write a size profile of the traces' first ops to <file>.\n");
+    fprintf(stderr, "\t-W <file>  Time the first ops cold, pre-warmed by <file> and steady.\n");
+    fprintf(stderr, "\t-N <n>     First ops for -G and -W (default 10000).\n");
+    fprintf(stderr, "\t-B <us>    Per-op latency with a maintenance thread every us, and inline.\n");
+    fprintf(stderr, "\t-C         Replay traces through mm_halloc and report mm_compact.\n");
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
@@ -0,0 +1,94 @@
+/*
+ * memcpy_bench.cc - copy bandwidth of memlib's mm_memcpy kernels by size.
+ *
+ * Each cell copies a src buffer of the given size to a dst buffer enough
+ * times to move at least 32MB, timed K-best with fsec(). "+nt" is the best
+ * kernel with non-temporal stores forced for every size; by default they
+ * only start at mem_nt_threshold() bytes. libc is the C library memcpy.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+
+#include "memlib.h"
+extern "C" {
+#include "fcyc.h"
+}
+
+static const size_t MAX_SIZE = 64 << 20;
+static const size_t BYTES_PER_RUN = 32 << 20;
+
+static unsigned char *src;
+static unsigned char *dst;
+static size_t size;
+static size_t reps;
+static bool use_libc;
+
+static void copy_run(void *arg)
+{
+    for (size_t i = 0; i < reps; i++) {
+        if (use_libc)
+            memcpy(dst, src, size);
+        else
+            mm_memcpy(dst, src, size);
+        asm volatile("" : : "r"(dst) : "memory");
+    }
+}
+
+/* GB/s for the current size with the given kernel (nullptr = libc) */
+static double bandwidth(const char *kernel, size_t nt)
+{
+    use_libc = kernel == nullptr;
+    if (kernel != nullptr) {
+        mem_set_copy_kernel(kernel);
+        mem_set_nt_threshold(nt);
+    }
+    reps = size < BYTES_PER_RUN ? BYTES_PER_RUN / size : 1;
+    double secs = fsec(copy_run, nullptr);
+    return (double)(reps * size) / secs * 1e-9;
+}
+
+static void *map_buffer()
+{
+    void *p = mmap(nullptr, MAX_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    memset(p, 1, MAX_SIZE);
+    return p;
+}
+
+int main()
+{
+    static const char *names[] = { "word", "sse2", "avx2" };
+    const int nnames = sizeof(names) / sizeof(names[0]);
+    const char *best = mem_copy_kernel();
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    src = static_cast<unsigned char *>(map_buffer());
+    dst = static_cast<unsigned char *>(map_buffer());
+
+    printf("GB/s; default kernel %s, non-temporal from %zu bytes\n",
+           best, mem_nt_threshold());
+    printf("%10s", "bytes");
+    for (int k = 0; k < nnames; k++)
+        printf(" %8s", names[k]);
+    printf(" %8s %8s\n", "+nt", "libc");
+
+    for (size = 64; size <= MAX_SIZE; size *= 4) {
+        printf("%10zu", size);
+        for (int k = 0; k < nnames; k++) {
+            if (mem_set_copy_kernel(names[k]))
+                printf(" %8.2f", bandwidth(names[k], 0));
+            else
+                printf(" %8s", "-");
+        }
+        printf(" %8.2f", bandwidth(best, 1));
+        printf(" %8.2f\n", bandwidth(nullptr, 0));
+    }
+    mem_set_copy_kernel(best);
+    mem_set_nt_threshold(0);
+    return 0;
+}
@@ -4,6 +4,7 @@
  * package with the system's malloc package in libc.
  *
  */
+#define _GNU_SOURCE /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,14 +15,292 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #include "memlib.h"
 #include "config.h"
 
+/*
+ * A region is one MAX_HEAP_SIZE reservation: the heap grows up from its
+ * start and the top region down from its end. The mm_* support routines
+ * work on the current region, which is the default one mem_init maps
+ * unless mm_region_use has switched to another.
+ */
+struct mm_region {
+    unsigned char *heap;                    /* Starting address of heap */
+    unsigned char *brk;                     /* Current position of break */
+    unsigned char *max_addr;                /* Maximum allowable heap address */
+    unsigned char *top;                     /* Lowest byte of the top region */
+    unsigned char *meta;                    /* Allocator state in a heap file, or NULL */
+    int state;                              /* MM_FILE_* */
+    struct mem_shared_hdr *shared;          /* Header of a shared segment, or NULL */
+};
+
+/*
+ * A heap file (mem_init_file) is mapped shared at the address it was
+ * created at, so the pointers stored in it mean the same thing to every
+ * process that maps it later. Its first page-aligned FILE_HDR_SIZE bytes
+ * are this header rather than heap: the default region's struct, so the
+ * break and the top region persist, a flag that says whether the last
+ * process to map it shut down cleanly, and MM_FILE_META_SIZE bytes for
+ * the allocator's own state.
+ */
+#define FILE_MAGIC 0x31706165686d6d23ull    /* "#mmheap1" */
+
+struct mem_file_hdr {
+    uint64_t magic;
+    uint64_t addr;                          /* where the file has to be mapped */
+    uint64_t size;                          /* length of the mapping */
+    uint64_t clean;                         /* set by mem_deinit after a full sync */
+    mm_region_t region;
+    unsigned char meta[MM_FILE_META_SIZE] __attribute__((aligned(64)));
+};
+
+#define FILE_HDR_SIZE ((sizeof(struct mem_file_hdr) + 4095) & ~(size_t) 4095)
+
+/*
+ * A shared region (mm_region_shared) is a named POSIX shared memory
+ * object that every process maps wherever mmap puts it, so its header
+ * keeps the break and the top as offsets from the segment base. They are
+ * written as they move and read back by mm_region_lock, whose mutex is
+ * process-shared and robust: a process that dies holding it does not
+ * block the others. The allocator's state goes in meta, as in a heap
+ * file; the region struct itself is private to each process.
+ */
+#define SHARED_MAGIC 0x31726873686d6d23ull  /* "#mmshr1" */
+#define SHARED_WAIT_MS 1000
+
+struct mem_shared_hdr {
+    uint64_t magic;                         /* set once the rest is ready */
+    uint64_t size;
+    uint64_t brk;
+    uint64_t top;
+    pthread_mutex_t lock;
+    unsigned char meta[MM_FILE_META_SIZE] __attribute__((aligned(64)));
+};
+
+#define SHARED_HDR_SIZE ((sizeof(struct mem_shared_hdr) + 4095) & ~(size_t) 4095)
+
 /* private global variables */
-static unsigned char *heap;                 /* Starting address of heap */
-static unsigned char *mem_brk;              /* Current position of break */
-static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
+static mm_region_t mem_default;
+static mm_region_t *mem = &mem_default;
+static mm_region_t *mem_main = &mem_default;   /* mem_default, or the one in the heap file */
+static struct mem_file_hdr *file_hdr = NULL;
+static int file_fd = -1;
+
+/* reserves a region's address space, or returns false */
+static bool region_map(mm_region_t *r) {
+    unsigned char* addr = mmap(NULL,                                        /* start*/
+                               MAX_HEAP_SIZE,                               /* length */
+                               PROT_READ | PROT_WRITE,                      /* permissions */
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, /* flags */
+                               -1,                                          /* fd */
+                               0);                                          /* offset */
+    if (addr == MAP_FAILED) {
+	return false;
+    }
+    r->heap = addr;
+    r->brk = addr;
+    r->max_addr = addr + MAX_HEAP_SIZE;
+    r->top = r->max_addr;
+    r->meta = NULL;
+    r->state = MM_FILE_ANON;
+    r->shared = NULL;
+    return true;
+}
+
+/* a shared region's break and top, for the other processes */
+static void region_publish(void) {
+    if (mem->shared != NULL) {
+	unsigned char *base = (unsigned char *) mem->shared;
+	mem->shared->brk = (uint64_t) (mem->brk - base);
+	mem->shared->top = (uint64_t) (mem->top - base);
+    }
+}
+
+/*
+ * mm_region_create - reserves a new, empty region. The region struct
+ *           lives in its own page, not in any heap.
+ */
+mm_region_t *mm_region_create(void) {
+    mm_region_t *r = mmap(NULL, sizeof(mm_region_t), PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) {
+	return NULL;
+    }
+    if (!region_map(r)) {
+	munmap(r, sizeof(mm_region_t));
+	return NULL;
+    }
+    return r;
+}
+
+/*
+ * mm_region_destroy - returns a region made by mm_region_create, and all
+ *           of its memory, to the OS. It must not be the current region.
+ */
+void mm_region_destroy(mm_region_t *r) {
+    if (r == NULL || r == mem_main || r == mem) {
+	return;
+    }
+    if (r->shared != NULL) {
+	/* only this process's mapping: the others may still use it */
+	munmap(r->shared, (size_t) (r->max_addr - (unsigned char *) r->shared));
+    } else {
+	munmap(r->heap, MAX_HEAP_SIZE);
+    }
+    munmap(r, sizeof(mm_region_t));
+}
+
+/*
+ * mm_region_shared - maps the shared segment name ("/name"), creating it
+ *           len bytes long (0: MM_SHARED_SIZE) if it does not exist. The
+ *           creator's region is MM_FILE_NEW, an opener's MM_FILE_CLEAN.
+ *           Destroying the region unmaps it; shm_unlink removes it.
+ */
+mm_region_t *mm_region_shared(const char *name, size_t len) {
+    bool created = true;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+	created = false;
+	fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0) {
+	return NULL;
+    }
+
+    struct stat st;
+    len = len ? len : MM_SHARED_SIZE;
+    if (created) {
+	if (len <= SHARED_HDR_SIZE || ftruncate(fd, (off_t) len) != 0) {
+	    close(fd);
+	    shm_unlink(name);
+	    return NULL;
+	}
+    } else {
+	/* the creator may not have sized it yet */
+	for (int i = 0; ; i++) {
+	    if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	    }
+	    if (st.st_size != 0 || i == SHARED_WAIT_MS) {
+		break;
+	    }
+	    usleep(1000);
+	}
+	len = (size_t) st.st_size;
+    }
+
+    struct mem_shared_hdr *h = mmap(NULL, len, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_NORESERVE, fd, 0);
+    close(fd);
+    if (len <= SHARED_HDR_SIZE || h == MAP_FAILED) {
+	return NULL;
+    }
+    mm_region_t *r = mmap(NULL, sizeof(mm_region_t), PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r == MAP_FAILED) {
+	munmap(h, len);
+	return NULL;
+    }
+
+    if (created) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&h->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	h->size = len;
+	h->brk = SHARED_HDR_SIZE;
+	h->top = len;
+	__atomic_store_n(&h->magic, SHARED_MAGIC, __ATOMIC_RELEASE);
+    } else {
+	for (int i = 0; __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) == 0 && i < SHARED_WAIT_MS; i++) {
+	    usleep(1000);
+	}
+	if (h->magic != SHARED_MAGIC || h->size != len) {
+	    munmap(h, len);
+	    munmap(r, sizeof(mm_region_t));
+	    return NULL;
+	}
+    }
+
+    unsigned char *base = (unsigned char *) h;
+    r->heap = base + SHARED_HDR_SIZE;
+    r->max_addr = base + len;
+    r->brk = base + h->brk;
+    r->top = base + h->top;
+    r->meta = h->meta;
+    r->state = created ? MM_FILE_NEW : MM_FILE_CLEAN;
+    r->shared = h;
+    return r;
+}
+
+/*
+ * mm_region_lock - takes a shared region's lock and catches up with the
+ *           break and top other processes left. MM_LOCK_DIED: the last
+ *           holder died holding it, and unless mm_region_consistent is
+ *           called before the unlock, the region is MM_LOCK_BROKEN for
+ *           good. Anonymous regions and heap files have no lock.
+ */
+int mm_region_lock(void) {
+    struct mem_shared_hdr *h = mem->shared;
+    if (h == NULL) {
+	return MM_LOCK_OK;
+    }
+    int rc = pthread_mutex_lock(&h->lock);
+    if (rc != 0 && rc != EOWNERDEAD) {
+	return MM_LOCK_BROKEN;
+    }
+    mem->brk = (unsigned char *) h + h->brk;
+    mem->top = (unsigned char *) h + h->top;
+    return rc == EOWNERDEAD ? MM_LOCK_DIED : MM_LOCK_OK;
+}
+
+void mm_region_consistent(void) {
+    if (mem->shared != NULL) {
+	pthread_mutex_consistent(&mem->shared->lock);
+    }
+}
+
+void mm_region_unlock(void) {
+    if (mem->shared != NULL) {
+	pthread_mutex_unlock(&mem->shared->lock);
+    }
+}
+
+/*
+ * mm_region_use - makes r (NULL: the default region) the one the support
+ *           routines work on, and returns the one that was
+ */
+mm_region_t *mm_region_use(mm_region_t *r) {
+    mm_region_t *prev = mem;
+    mem = r ? r : mem_main;
+    return prev;
+}
+
+/*
+ * mm_file_meta - the allocator's MM_FILE_META_SIZE bytes inside the heap
+ *           file, if the current region is one (NULL otherwise)
+ */
+void *mm_file_meta(void) {
+    return mem->meta;
+}
+
+/*
+ * mm_file_state - MM_FILE_ANON for an anonymous region; for a heap file,
+ *           whether it was just created (MM_FILE_NEW), or was last shut
+ *           down cleanly (MM_FILE_CLEAN) or not (MM_FILE_DIRTY)
+ */
+int mm_file_state(void) {
+    return mem->state;
+}
 
 /* 
  * mm_sbrk - simple model of the sbrk function. Extends the heap 
@@ -29,19 +308,20 @@ static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
  *           new area. In this model, the heap cannot be shrunk.
  */
 void *mm_sbrk(intptr_t incr) {
-    unsigned char *old_brk = mem_brk;
+    unsigned char *old_brk = mem->brk;
 
     bool ok = true;
     if (incr < 0) {
 	ok = false;
 	fprintf(stderr, "ERROR: mm_sbrk failed.  Attempt to expand heap by negative value %ld\n", (long) incr);
-    } else if (mem_brk + incr > mem_max_addr) {
+    } else if (incr > mem->top - mem->brk) {
 	ok = false;
-	long alloc = mem_brk - heap + incr;
+	long alloc = mem->brk - mem->heap + (mem->max_addr - mem->top) + incr;
 	fprintf(stderr, "ERROR: mm_sbrk failed. Ran out of memory.  Would require heap size of %zd (0x%zx) bytes\n", alloc, alloc);
     }
     if (ok) {
-	mem_brk += incr;
+	mem->brk += incr;
+	region_publish();
 	return (void *) old_brk;
     } else {
 	errno = ENOMEM;
@@ -53,21 +333,52 @@ void *mm_sbrk(intptr_t incr) {
  * mm_heap_lo - return address of the first heap byte
  */
 void *mm_heap_lo(){
-    return (void *) heap;
+    return (void *) mem->heap;
 }
 
 /* 
  * mm_heap_hi - return address of last heap byte
  */
 void *mm_heap_hi(){
-    return (void *)(mem_brk - 1);
+    return (void *)(mem->brk - 1);
 }
 
 /*
- * mm_heapsize - returns the heap size in bytes
+ * mm_heapsize - returns the heap size in bytes, both regions included
  */
 size_t mm_heapsize() {
-    return (size_t)(mem_brk - heap);
+    return (size_t)(mem->brk - mem->heap) + (size_t)(mem->max_addr - mem->top);
+}
+
+/*
+ * mm_sbrk_top - grows the top region, which starts at the end of the
+ *           reservation and extends downward, by incr bytes. Returns the
+ *           new lowest address of the region, i.e. the start of the new
+ *           area. The two regions may not cross.
+ */
+void *mm_sbrk_top(intptr_t incr) {
+    if (incr < 0 || incr > mem->top - mem->brk) {
+	fprintf(stderr, "ERROR: mm_sbrk_top failed.  Cannot grow top region by %ld\n", (long) incr);
+	errno = ENOMEM;
+	return (void *) -1;
+    }
+    mem->top -= incr;
+    region_publish();
+    return (void *) mem->top;
+}
+
+/*
+ * mm_top_lo - return address of the lowest top region byte
+ */
+void *mm_top_lo(){
+    return (void *) mem->top;
+}
+
+/*
+ * mm_top_hi - return address of the last top region byte
+ */
+void *mm_top_hi(){
+    return (void *)(mem->max_addr - 1);
 }
 
 /*
@@ -77,10 +388,138 @@ size_t mm_pagesize(){
     return (size_t) getpagesize();
 }
 
+/* whether [p, p + len) lies inside one of the two heap regions */
+static bool in_regions(unsigned char *p, size_t len) {
+    return (p >= mem->heap && p + len <= mem->brk) ||
+	(p >= mem->top && p + len <= mem->max_addr);
+}
+
 /*
- * mm_memcpy - copies n bytes from src to dst
+ * mm_remap - moves len bytes from src to dst by remapping whole pages, and
+ *            leaves fresh zero pages at src. Both must be page aligned
+ *            heap addresses and the ranges must not overlap. Returns dst,
+ *            or NULL if the kernel refused, in which case nothing moved.
+ *            A heap file or shared segment always refuses: moving its
+ *            pages would move them to other file offsets.
  */
-void *mm_memcpy(void *dst, const void *src, size_t n) {
+void *mm_remap(void *dst, void *src, size_t len) {
+    unsigned char *d = dst, *s = src;
+    size_t page = (size_t) getpagesize();
+    if (len == 0 || ((uintptr_t) d | (uintptr_t) s | len) & (page - 1) ||
+	mem->meta != NULL || !in_regions(d, len) || !in_regions(s, len) ||
+	(d < s + len && s < d + len)) {
+	return NULL;
+    }
+    /*
+     * the heap has to stay one contiguous mapping, so the zero pages that
+     * refill src are mapped first: past this point nothing needs memory
+     */
+    void *fill = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (fill == MAP_FAILED) {
+	return NULL;
+    }
+    if (mremap(s, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, d) == MAP_FAILED) {
+	munmap(fill, len);
+	return NULL;
+    }
+    if (mremap(fill, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, s) == MAP_FAILED) {
+	/* put the pages back where they were, and the zero pages at dst */
+	if (mremap(d, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, s) != MAP_FAILED) {
+	    mremap(fill, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, d);
+	}
+	return NULL;
+    }
+    return dst;
+}
+
+/*
+ * mm_prefault - backs the heap pages under [lo, lo + len) with memory now,
+ *               in one call where the kernel can, rather than one page
+ *               fault at a time as they are first written
+ */
+void mm_prefault(void *lo, size_t len) {
+    unsigned char *p = lo;
+    size_t page = (size_t) getpagesize();
+    if (len == 0 || !in_regions(p, len)) {
+	return;
+    }
+    uintptr_t a = (uintptr_t) p & ~(page - 1);
+    uintptr_t b = ((uintptr_t) p + len + page - 1) & ~(page - 1);
+#ifdef MADV_POPULATE_WRITE
+    if (madvise((void *) a, b - a, MADV_POPULATE_WRITE) == 0) {
+	return;
+    }
+#endif
+    /* older kernels: touch one byte per page, keeping what is there */
+    for (uintptr_t q = a; q < b; q += page) {
+	volatile unsigned char *c = (unsigned char *) (q < (uintptr_t) p ? (uintptr_t) p : q);
+	*c = *c;
+    }
+}
+
+/*
+ * mm_trim - lowers the break by decr bytes and returns the whole pages
+ *           above the new break to the OS (for a heap file, frees their
+ *           blocks in the file). Fails, changing nothing, if that would
+ *           go below the start of the heap.
+ */
+bool mm_trim(size_t decr) {
+    if (decr > (size_t) (mem->brk - mem->heap)) {
+	return false;
+    }
+    size_t page = (size_t) getpagesize();
+    uintptr_t lo = ((uintptr_t) (mem->brk - decr) + page - 1) & ~(page - 1);
+    uintptr_t hi = ((uintptr_t) mem->brk + page - 1) & ~(page - 1);
+    if (hi > lo) {
+	madvise((void *) lo, hi - lo, mem->meta ? MADV_REMOVE : MADV_DONTNEED);
+    }
+    /* a heap file or segment stays zero above the break, so the allocator
+       can tell a block it was about to write after a crash from old data */
+    if (mem->meta != NULL) {
+	unsigned char *end = (uintptr_t) mem->brk < lo ? mem->brk : (unsigned char *) lo;
+	memset(mem->brk - decr, 0, (size_t) (end - (mem->brk - decr)));
+    }
+    mem->brk -= decr;
+    region_publish();
+    return true;
+}
+
+/*
+ * mm_trim_top - shrinks the top region by decr bytes from below and
+ *           returns the whole pages that leaves to the OS.
+ */
+bool mm_trim_top(size_t decr) {
+    if (decr > (size_t) (mem->max_addr - mem->top)) {
+	return false;
+    }
+    size_t page = (size_t) getpagesize();
+    uintptr_t lo = ((uintptr_t) mem->top + page - 1) & ~(page - 1);
+    uintptr_t hi = ((uintptr_t) (mem->top + decr)) & ~(page - 1);
+    if (hi > lo) {
+	madvise((void *) lo, hi - lo, mem->meta ? MADV_REMOVE : MADV_DONTNEED);
+    }
+    mem->top += decr;
+    region_publish();
+    return true;
+}
+
+/*
+ * Copy and fill kernels. The word kernels go through mem_read/mem_write one
+ * 8-byte word at a time; on x86-64 the SSE2 and AVX2 kernels move 16 or 32
+ * bytes per access, and switch to non-temporal stores for blocks of at
+ * least nt_threshold bytes (the last-level cache size) so a big realloc
+ * copy or calloc fill does not evict the caller's working set. The kernel
+ * is picked from cpuid on first use.
+ */
+typedef void *(*copy_fn)(void *dst, const void *src, size_t n);
+typedef void *(*fill_fn)(void *dst, int c, size_t n);
+
+#define NT_DEFAULT (8 * 1024 * 1024)
+
+static size_t nt_threshold = 0;
+
+static void *copy_word(void *dst, const void *src, size_t n) {
     void *savedst = dst;
     size_t w = sizeof(uint64_t);
     while (n >= w) {
@@ -97,10 +536,7 @@ void *mm_memcpy(void *dst, const void *src, size_t n) {
     return savedst;
 }
 
-/*
- * mm_memset - sets the first n bytes of memory pointed to by dst to c
- */
-void *mm_memset(void *dst, int c, size_t n) {
+static void *fill_word(void *dst, int c, size_t n) {
     void *savedst = dst;
     uint64_t byte = c & 0xFF;
     uint64_t data = 0;
@@ -120,42 +556,363 @@ void *mm_memset(void *dst, int c, size_t n) {
     return savedst;
 }
 
+#if defined(__x86_64__)
+/*
+ * Blocks shorter than one vector use the word kernels. Longer ones do a
+ * leading unaligned vector, a loop with the stores aligned to the vector
+ * size, and a trailing unaligned vector that may overlap the loop.
+ */
+static void *copy_sse2(void *dst, const void *src, size_t n) {
+    if (n < 16) {
+	return copy_word(dst, src, n);
+    }
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+    __m128i tail = _mm_loadu_si128((const __m128i *) (s + n - 16));
+    _mm_storeu_si128((__m128i *) d, _mm_loadu_si128((const __m128i *) s));
+    size_t skip = 16 - ((uintptr_t) d & 15);
+    unsigned char *end = d + n - 16;
+    s += skip;
+    d += skip;
+    if (n >= nt_threshold) {
+	for (; d < end; d += 16, s += 16) {
+	    _mm_stream_si128((__m128i *) d, _mm_loadu_si128((const __m128i *) s));
+	}
+	_mm_sfence();
+    } else {
+	for (; d < end; d += 16, s += 16) {
+	    _mm_store_si128((__m128i *) d, _mm_loadu_si128((const __m128i *) s));
+	}
+    }
+    _mm_storeu_si128((__m128i *) end, tail);
+    return dst;
+}
+
+static void *fill_sse2(void *dst, int c, size_t n) {
+    if (n < 16) {
+	return fill_word(dst, c, n);
+    }
+    unsigned char *d = dst;
+    __m128i v = _mm_set1_epi8((char) c);
+    unsigned char *end = d + n - 16;
+    _mm_storeu_si128((__m128i *) d, v);
+    d += 16 - ((uintptr_t) d & 15);
+    if (n >= nt_threshold) {
+	for (; d < end; d += 16) {
+	    _mm_stream_si128((__m128i *) d, v);
+	}
+	_mm_sfence();
+    } else {
+	for (; d < end; d += 16) {
+	    _mm_store_si128((__m128i *) d, v);
+	}
+    }
+    _mm_storeu_si128((__m128i *) end, v);
+    return dst;
+}
+
+__attribute__((target("avx2")))
+static void *copy_avx2(void *dst, const void *src, size_t n) {
+    if (n < 32) {
+	return copy_sse2(dst, src, n);
+    }
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+    __m256i tail = _mm256_loadu_si256((const __m256i *) (s + n - 32));
+    _mm256_storeu_si256((__m256i *) d, _mm256_loadu_si256((const __m256i *) s));
+    size_t skip = 32 - ((uintptr_t) d & 31);
+    unsigned char *end = d + n - 32;
+    s += skip;
+    d += skip;
+    if (n >= nt_threshold) {
+	for (; d < end; d += 32, s += 32) {
+	    _mm256_stream_si256((__m256i *) d, _mm256_loadu_si256((const __m256i *) s));
+	}
+	_mm_sfence();
+    } else {
+	for (; d + 32 < end; d += 64, s += 64) {
+	    __m256i a = _mm256_loadu_si256((const __m256i *) s);
+	    __m256i b = _mm256_loadu_si256((const __m256i *) (s + 32));
+	    _mm256_store_si256((__m256i *) d, a);
+	    _mm256_store_si256((__m256i *) (d + 32), b);
+	}
+	if (d < end) {
+	    _mm256_store_si256((__m256i *) d, _mm256_loadu_si256((const __m256i *) s));
+	}
+    }
+    _mm256_storeu_si256((__m256i *) end, tail);
+    return dst;
+}
+
+__attribute__((target("avx2")))
+static void *fill_avx2(void *dst, int c, size_t n) {
+    if (n < 32) {
+	return fill_sse2(dst, c, n);
+    }
+    unsigned char *d = dst;
+    __m256i v = _mm256_set1_epi8((char) c);
+    unsigned char *end = d + n - 32;
+    _mm256_storeu_si256((__m256i *) d, v);
+    d += 32 - ((uintptr_t) d & 31);
+    if (n >= nt_threshold) {
+	for (; d < end; d += 32) {
+	    _mm256_stream_si256((__m256i *) d, v);
+	}
+	_mm_sfence();
+    } else {
+	for (; d < end; d += 32) {
+	    _mm256_store_si256((__m256i *) d, v);
+	}
+    }
+    _mm256_storeu_si256((__m256i *) end, v);
+    return dst;
+}
+#endif /* __x86_64__ */
+
+static const struct {
+    const char *name;
+    copy_fn copy;
+    fill_fn fill;
+} kernels[] = {
+    { "word", copy_word, fill_word },
+#if defined(__x86_64__)
+    { "sse2", copy_sse2, fill_sse2 },
+    { "avx2", copy_avx2, fill_avx2 },
+#endif
+};
+
+static int kernel = -1;
+
+static size_t llc_size(void) {
+    long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    return llc > 0 ? (size_t) llc : NT_DEFAULT;
+}
+
+static bool kernel_supported(int k) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (strcmp(kernels[k].name, "avx2") == 0) {
+	return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return true;
+}
+
+/* Best kernel the CPU has, and the cache size for non-temporal stores */
+static void pick_kernel(void) {
+    int k = (int) (sizeof(kernels) / sizeof(kernels[0])) - 1;
+    while (!kernel_supported(k)) {
+	k--;
+    }
+    if (nt_threshold == 0) {
+	nt_threshold = llc_size();
+    }
+    kernel = k;
+}
+
+/*
+ * mm_memcpy - copies n bytes from src to dst
+ */
+void *mm_memcpy(void *dst, const void *src, size_t n) {
+    if (kernel < 0) {
+	pick_kernel();
+    }
+    return kernels[kernel].copy(dst, src, n);
+}
+
+/*
+ * mm_memset - sets the first n bytes of memory pointed to by dst to c
+ */
+void *mm_memset(void *dst, int c, size_t n) {
+    if (kernel < 0) {
+	pick_kernel();
+    }
+    return kernels[kernel].fill(dst, c, n);
+}
+
+/*
+ * mem_copy_kernel - name of the kernel mm_memcpy/mm_memset use
+ */
+const char *mem_copy_kernel(void) {
+    if (kernel < 0) {
+	pick_kernel();
+    }
+    return kernels[kernel].name;
+}
+
+/*
+ * mem_set_copy_kernel - use the named kernel; false if unknown or the
+ *                       CPU lacks it
+ */
+bool mem_set_copy_kernel(const char *name) {
+    if (kernel < 0) {
+	pick_kernel();
+    }
+    int k;
+    for (k = 0; k < (int) (sizeof(kernels) / sizeof(kernels[0])); k++) {
+	if (strcmp(kernels[k].name, name) == 0 && kernel_supported(k)) {
+	    kernel = k;
+	    return true;
+	}
+    }
+    return false;
+}
+
+/*
+ * mem_set_nt_threshold - blocks of at least bytes use non-temporal stores
+ *                        (0 = last-level cache size)
+ */
+void mem_set_nt_threshold(size_t bytes) {
+    if (kernel < 0) {
+	pick_kernel();
+    }
+    nt_threshold = bytes ? bytes : llc_size();
+}
+
+size_t mem_nt_threshold(void) {
+    if (kernel < 0) {
+	pick_kernel();
+    }
+    return nt_threshold;
+}
+
 /*************** Memory emulation  *******************/
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(){
-    unsigned char* addr = mmap(NULL,                                        /* start*/
-                               MAX_HEAP_SIZE,                               /* length */
-                               PROT_READ | PROT_WRITE,                      /* permissions */
-                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, /* flags */
-                               -1,                                          /* fd */
-                               0);                                          /* offset */
-    if (addr == MAP_FAILED) {
+    if (!region_map(&mem_default)) {
 	fprintf(stderr, "FAILURE.  mmap couldn't allocate space for heap\n");
 	exit(1);
     }
-    heap = addr;
-    mem_max_addr = addr + MAX_HEAP_SIZE;
-    mem_reset_brk();
+    mem = mem_main = &mem_default;
+}
+
+/* closes a heap file mapped at hdr, len bytes long */
+static void file_close(void *hdr, size_t len, int fd) {
+    munmap(hdr, len);
+    close(fd);
+}
+
+/*
+ * mem_init_file - use the heap file at path as the default region, in
+ *           place of mem_init. A new (or empty) file is sized to len
+ *           bytes (0: MM_FILE_SIZE) and mapped at addr (NULL:
+ *           MM_FILE_ADDR); an existing one is mapped where it was
+ *           created, and addr and len must be NULL/0 or match. Fails if
+ *           the file is not a heap file or its address is taken.
+ */
+bool mem_init_file(const char *path, void *addr, size_t len) {
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+	if (fd >= 0) {
+	    close(fd);
+	}
+	return false;
+    }
+
+    /* a file whose creator died before writing the header is still new */
+    struct mem_file_hdr old;
+    ssize_t got = st.st_size == 0 ? 0 : pread(fd, &old, sizeof(old), 0);
+    bool fresh = st.st_size == 0 || (got == (ssize_t) sizeof(old) && old.magic == 0);
+    if (!fresh) {
+	/* too short to hold a header: not a heap file */
+	if (got != (ssize_t) sizeof(old) || old.magic != FILE_MAGIC ||
+	    (addr != NULL && (uintptr_t) addr != old.addr) || (len != 0 && len != old.size) ||
+	    (uint64_t) st.st_size != old.size) {
+	    close(fd);
+	    return false;
+	}
+	addr = (void *) (uintptr_t) old.addr;
+	len = old.size;
+    } else {
+	addr = addr ? addr : (void *) MM_FILE_ADDR;
+	len = len ? len : MM_FILE_SIZE;
+	if (len <= FILE_HDR_SIZE || ftruncate(fd, (off_t) len) != 0) {
+	    close(fd);
+	    return false;
+	}
+    }
+
+    /* never over an existing mapping: the address is part of the format */
+    struct mem_file_hdr *h = mmap(addr, len, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_NORESERVE | MAP_FIXED_NOREPLACE, fd, 0);
+    if (h == MAP_FAILED) {
+	close(fd);
+	return false;
+    }
+    if ((void *) h != addr) {
+	file_close(h, len, fd);
+	return false;
+    }
+
+    mm_region_t *r = &h->region;
+    unsigned char *base = (unsigned char *) h;
+    if (fresh) {
+	r->heap = r->brk = base + FILE_HDR_SIZE;
+	r->max_addr = r->top = base + len;
+	r->meta = h->meta;
+	r->state = MM_FILE_NEW;
+	r->shared = NULL;
+	h->addr = (uintptr_t) addr;
+	h->size = len;
+	h->magic = FILE_MAGIC;
+    } else if (r->heap != base + FILE_HDR_SIZE || r->max_addr != base + len ||
+	       r->brk < r->heap || r->top < r->brk || r->top > r->max_addr || r->meta != h->meta) {
+	file_close(h, len, fd);
+	return false;
+    } else {
+	r->state = h->clean ? MM_FILE_CLEAN : MM_FILE_DIRTY;
+    }
+    /* from here until mem_deinit, a crash leaves the file dirty */
+    h->clean = 0;
+    msync(h, FILE_HDR_SIZE, MS_SYNC);
+
+    file_hdr = h;
+    file_fd = fd;
+    mem = mem_main = r;
+    return true;
 }
 
 /* 
- * mem_deinit - free the storage used by the memory system model
+ * mem_deinit - free the storage used by the memory system model. A heap
+ *           file is written back and marked clean before it is unmapped.
  */
 void mem_deinit(void){
-    if (munmap(heap, MAX_HEAP_SIZE) != 0) {
+    if (file_hdr != NULL) {
+	mm_region_t *r = &file_hdr->region;
+	size_t len = file_hdr->size;
+	msync(r->heap, (size_t) (r->brk - r->heap), MS_SYNC);
+	msync(r->top, (size_t) (r->max_addr - r->top), MS_SYNC);
+	file_hdr->clean = 1;
+	msync(file_hdr, FILE_HDR_SIZE, MS_SYNC);
+	file_close(file_hdr, len, file_fd);
+	file_hdr = NULL;
+	file_fd = -1;
+	mem = mem_main = &mem_default;
+	return;
+    }
+    if (munmap(mem_default.heap, MAX_HEAP_SIZE) != 0) {
         fprintf(stderr, "FAILURE.  munmap couldn't deallocate heap space\n");
         exit(1);
     }
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap.
+ *           In a heap file this also drops the allocator's state, so the
+ *           next mm_init starts a new heap rather than reattaching.
  */
 void mem_reset_brk(){
-    mem_brk = heap;
+    if (mem_main->meta != NULL) {
+	madvise(mem_main->heap, (size_t) (mem_main->brk - mem_main->heap), MADV_REMOVE);
+	memset(mem_main->meta, 0, MM_FILE_META_SIZE);
+	mem_main->state = MM_FILE_NEW;
+    }
+    mem_main->brk = mem_main->heap;
+    mem_main->top = mem_main->max_addr;
 }
 
 void *mem_sbrk(intptr_t incr) {
@@ -163,15 +920,23 @@ void *mem_sbrk(intptr_t incr) {
 }
 
 void *mem_heap_lo(){
-    return (void *) heap;
+    return (void *) mem->heap;
 }
 
 void *mem_heap_hi(){
-    return (void *)(mem_brk - 1);
+    return (void *)(mem->brk - 1);
+}
+
+void *mem_top_lo(){
+    return (void *) mem->top;
+}
+
+void *mem_top_hi(){
+    return (void *)(mem->max_addr - 1);
 }
 
 size_t mem_heapsize() {
-    return (size_t)(mem_brk - heap);
+    return (size_t)(mem->brk - mem->heap) + (size_t)(mem->max_addr - mem->top);
 }
 
 size_t mem_pagesize(){
@@ -1,26 +1,71 @@
+#ifndef __MEMLIB_H_
+#define __MEMLIB_H_
+
 #include <unistd.h>
 #include <stdint.h>
 #include <stdbool.h>
 
-/* Support routines */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Support routines; they work on the current region */
+
+typedef struct mm_region mm_region_t;
+mm_region_t *mm_region_create(void);
+void mm_region_destroy(mm_region_t *r);
+mm_region_t *mm_region_use(mm_region_t *r);
+
+/* Heap files (mem_init_file): room for the allocator's state, and how the file was found */
+#define MM_FILE_META_SIZE (16 * 1024)
+#define MM_FILE_ANON 0
+#define MM_FILE_NEW 1
+#define MM_FILE_CLEAN 2
+#define MM_FILE_DIRTY 3
+void *mm_file_meta(void);
+int mm_file_state(void);
+
+/* Shared segments: named, mapped at a different address in each process */
+#define MM_SHARED_SIZE ((size_t) 1 << 32)
+#define MM_LOCK_OK 0
+#define MM_LOCK_DIED 1
+#define MM_LOCK_BROKEN 2
+mm_region_t *mm_region_shared(const char *name, size_t len);
+int mm_region_lock(void);
+void mm_region_consistent(void);
+void mm_region_unlock(void);
 
 void *mm_sbrk(intptr_t incr);
 void *mm_heap_lo(void);
 void *mm_heap_hi(void);
 size_t mm_heapsize(void);
+void *mm_sbrk_top(intptr_t incr);
+void *mm_top_lo(void);
+void *mm_top_hi(void);
 size_t mm_pagesize(void);
 void *mm_memcpy(void *dst, const void *src, size_t n);
 void *mm_memset(void *dst, int c, size_t n);
+void *mm_remap(void *dst, void *src, size_t len);
+bool mm_trim(size_t decr);
+bool mm_trim_top(size_t decr);
+void mm_prefault(void *lo, size_t len);
 
 /* Functions used for memory emulation */
 /* You should not be calling these functions */
 
 void mem_init();               
 void mem_deinit(void);
+
+/* Default region from a heap file mapped at a fixed address, in place of mem_init */
+#define MM_FILE_ADDR 0x200000000000ull
+#define MM_FILE_SIZE ((size_t) 1 << 36)
+bool mem_init_file(const char *path, void *addr, size_t len);
 void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_top_lo(void);
+void *mem_top_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
 
@@ -38,5 +83,19 @@ void *mem_memcpy(void *dst, const void *src, size_t n);
 /* Emulation of memset */
 void *mem_memset(void *dst, int c, size_t n);
 
+/* Copy/fill kernel used by mm_memcpy and mm_memset: "word", "sse2", "avx2" */
+const char *mem_copy_kernel(void);
+bool mem_set_copy_kernel(const char *name);
+
+/* Blocks of at least this many bytes are copied with non-temporal stores */
+size_t mem_nt_threshold(void);
+void mem_set_nt_threshold(size_t bytes);
+
 /* Debugging function to view region of heap */
 void hprobe(void *ptr, int offset, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MEMLIB_H_ */
@@ -14,17 +14,80 @@
  * if no block is found, extend the heap to allocate the new block
  * 
  * free:
- * marks the block as free and adds it to the free list
+ * blocks up to 256 bytes go onto an exact-size LIFO fast bin that malloc
+ * pops directly; larger ones are marked free and added to the free list
  * coalesces the block with adjacent free blocks (not directly using coalescing function but more of a merge)
  * 
  * realloc:
  * if new size is 0, frees the block
  * the the old pointer is NULL, allocates a new block
- * else allocates a new block, copies the old data, and free the old block
+ * else resizes in place when the block, the heap end or a free neighbour
+ * allows it, and otherwise allocates a new block, copies the old data, and
+ * free the old block. blocks that keep growing are moved with 50% spare
+ * capacity unless the heap is nearly full. blocks of 1MB and up are page
+ * aligned and moved by remapping their pages rather than copying them
  * 
  * calloc:
  * allocates a new block of memory and sets it to 0
  * 
+ * mm_nallocx/mm_xallocx:
+ * the usable size a request would get, and an in-place resize into a
+ * free neighbour or the heap end that never moves the block, so
+ * containers can size and grow their buffers without copies.
+ * 
+ * two-ended heap (mm_set_two_ended):
+ * blocks of 4KB and up come from a region growing down from the top of
+ * the heap reservation, small ones from the bottom, so large buffers do
+ * not pin small holes between them.
+ * 
+ * adaptive size classes (mm_set_adaptive_classes):
+ * the classes below 2KB are redrawn from a histogram of request sizes, so
+ * a hot size range gets several classes and cold ones share one. Sizes
+ * the fast bins serve exactly gain nothing; a hot range above them does.
+ * 
+ * pre-warming (mm_set_profile):
+ * mm_init carves the blocks a size profile lists out of one heap
+ * extension, so a service's first requests are pops from warm lists.
+ * 
+ * lifetime hints (mm_malloc_hint):
+ * long-lived blocks go to the top region, short-lived ones to the bottom.
+ * 
+ * side table (mm_set_side_table):
+ * mirrors block starts and free state in bitmaps beside the heap, so
+ * consolidate() walks dense metadata and the checker catches headers
+ * overwritten from a neighbouring payload.
+ * 
+ * hardened mode (mm_set_hardened):
+ * checksums allocated headers, catches double and invalid frees, and encodes
+ * the free-list links. mdriver -H reports what it costs.
+ * 
+ * background maintenance (mm_set_background/mm_maintain):
+ * a thread merges the fast bins back into the lists and trims the heap
+ * end in short steps, so no malloc pays for a whole consolidation.
+ * 
+ * persistent heap (mem_init_file/mm_set_root):
+ * in a heap file the default heap keeps its state inside the file, so
+ * mm_init reattaches to the heap a previous run left there instead of
+ * starting empty, and checks and rebuilds it if that run crashed.
+ * 
+ * shared heaps (mm_shared_open):
+ * a heap in a named shared memory segment that processes map at
+ * different addresses. Free-list links are stored as offsets, each call
+ * takes the segment's robust lock, and a holder that dies is recovered
+ * from like a crashed heap file.
+ * 
+ * heap instances (mm_heap_create/mm_heap_malloc/mm_heap_free):
+ * independent heaps, each in its own memlib region; the global calls use
+ * a default heap. mm_heap_destroy drops a whole heap at once.
+ * 
+ * handles (mm_halloc/mm_hderef/mm_hfree):
+ * relocatable blocks reached through a handle table. mm_compact slides
+ * them down over free space and trims the heap top.
+ * 
+ * mm_checkheap:
+ * walks the heap and cross-checks the free lists against it with a bitmap,
+ * or with mm_set_check_budget(n) checks only the next n blocks per call.
+ * 
  * 
  * 
  * used macros and code taken from the book Computer Systems. Macros have been adapted into helper functions.
@@ -39,11 +102,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "mm_tune.h"
 
 /*
  * If you want to enable your debugging output and heap checker code,
@@ -71,6 +140,13 @@
 #define calloc mm_calloc
 #define memset mm_memset
 #define memcpy mm_memcpy
+#else
+// libmm.so: libmm.c exports the libc names and locks/initializes around
+// these, so build the same mm_ entry points here
+#define malloc mm_malloc
+#define free mm_free
+#define realloc mm_realloc
+#define calloc mm_calloc
 #endif // DRIVER
 
 #define ALIGNMENT 16
@@ -84,9 +160,209 @@ static size_t align(size_t x)
 static const size_t WSIZE = 8;
 static const size_t  DSIZE = 8;
 //static const size_t CHUNKSIZE = (1<<12);
-static char *heap_listp;
 
-struct block_meta *free_list = NULL; //global pointer
+/*
+ * Hardened mode. Every header/footer word carries a 16 bit checksum of
+ * its own address, size and alloc bit in the top bits (the heap is capped
+ * at 1TB so sizes never reach them), free() refuses blocks whose alloc bit
+ * is already clear, and free-list links are stored offset by a per-heap
+ * secret. Toggled at runtime so mdriver can time both variants from the
+ * same build.
+ */
+static bool hardened = false;
+static const size_t CHECK_SHIFT = 48;
+static const size_t SIZE_MASK = (((size_t)1 << 48) - 1) & ~(size_t)0xF;
+
+// largest request any entry point serves: past it align(size + 8), or
+// size plus an alignment or pad, could wrap around to a small block
+static const size_t MAX_REQUEST = SIZE_MASK / 2;
+
+// free blocks up to FAST_MAX bytes sit in exact-size LIFO fast bins with
+// FAST_BIT set in the header, and are only merged by consolidate()
+static const size_t FAST_MAX = MM_FAST_MAX;
+static const int FAST_BINS = MM_FAST_MAX / ALIGNMENT;
+
+// split() leaves a free remainder of at least SPLIT_MIN bytes; the bottom
+// region grows by at least GROW_CHUNK bytes at a time (see mm_tune.h)
+static const size_t SPLIT_MIN = MM_SPLIT_MIN;
+static const size_t GROW_CHUNK = MM_GROW_CHUNK;
+static const size_t default_bounds[13] = { MM_CLASS_BOUNDS };
+
+/*
+ * Adaptive size classes (mm_set_adaptive_classes). malloc counts requests
+ * of up to HIST_MAX bytes in a histogram with one bin per 16 bytes. Once
+ * at least ADAPT_MIN mallocs have asked for as many bytes as the heap
+ * holds, the classes below HIST_MAX are redrawn so that each takes about
+ * the same share of the recent requests: a hot range is split
+ * over several classes and cold ones merge into one, with the classes left
+ * over empty. The classes above HIST_MAX keep their mm_tune.h bounds. New
+ * bounds take effect with a consolidation, which rebuilds every list
+ * under them, and the histogram is halved to follow the workload. Tying
+ * the period to the bytes allocated keeps that heap-sized rebuild at a
+ * constant cost per byte while a small heap adapts within a few thousand
+ * requests.
+ */
+static bool adaptive = false;
+static const size_t HIST_MAX = 2048;
+static const size_t ADAPT_MIN = 1024;
+
+/*
+ * Pre-warming (mm_set_profile). A profile lists request sizes and how many
+ * blocks of each a run needs early on. mm_init grows the heap once for all
+ * of them, faults the pages in, and carves the blocks out ahead of time:
+ * small ones onto the fast bins, the rest onto the segregated lists in
+ * ascending size order, so the first requests of each size are pops. The
+ * fast-bin bytes carved this way are warm_floor, which the consolidation
+ * trigger discounts until the first merge; otherwise the first large miss
+ * would merge the warm blocks back together.
+ */
+static const int WARM_SIZES = 64;
+static const size_t WARM_MAX = (size_t)64 << 20; // carve at most 64MB
+static size_t warm_size[64];
+static size_t warm_count[64];
+static int warm_sizes = 0;
+static const size_t FAST_BIT = 0x2;
+
+// set on allocated blocks that realloc has grown; a block grown again is
+// moved with GROW_RESERVE extra capacity (as a fraction of the request),
+// unless more than PRESSURE_PCT percent of the heap is allocated already
+static const size_t GROW_BIT = 0x4;
+static const size_t GROW_RESERVE = 2; // 1/2 of the request
+static const size_t PRESSURE_PCT = 90;
+
+// set on allocated blocks owned by a handle (mm_halloc); mm_compact may
+// move them. The payload starts with the handle's table index, padded to
+// HANDLE_PAD bytes so the caller's part stays 16-byte aligned
+static const size_t HANDLE_BIT = 0x8;
+static const size_t HANDLE_PAD = 16;
+
+// requests of at least REMAP_MIN bytes get page-aligned payloads, and
+// realloc moves their whole pages with mm_remap instead of copying them
+static const size_t REMAP_MIN = 1 << 20;
+
+/*
+ * Two-ended heap. Blocks of TOP_MIN bytes and up come from a second region
+ * that memlib grows down from the end of the heap reservation, so large
+ * buffers no longer sit between small blocks and pin their holes, and the
+ * small-object pages stay dense. The top region has its own segregated
+ * lists and never feeds the fast bins; its last word, at top_hi, is a zero
+ * size allocated sentinel like an epilogue. With the mode off top_lo and
+ * top_hi stay at the end of the address space, so "hp >= top_lo" is false
+ * for every block and the large-request test "asize >= top_min" never
+ * holds. Toggled at runtime like hardened mode.
+ */
+static bool two_ended = false;
+static const size_t TOP_MIN = 4096;
+static const size_t TOP_MERGE_SHARE = 16; // merge once 1/16 of the region is loose
+
+/*
+ * Heap instances (mm_heap_create). All allocator state lives in a struct
+ * mm_heap, and every routine works on the one cur points at: the default
+ * heap behind mm_malloc and friends, or a heap of its own that the
+ * mm_heap_* calls switch to, together with its memlib region, for the
+ * length of the call. A heap only ever holds blocks from its own region,
+ * so tenants cannot fragment each other's memory, and destroying a heap
+ * returns all of it at once. The mode setters only record the mode; a
+ * heap takes it at mm_init and keeps the layout it was formatted with.
+ */
+struct mm_heap {
+   mm_region_t *region;     // memlib region it grows in, NULL for the default
+   char *heap_listp;
+   char *region_end;        // end of the region's mapping, see in_heap
+   bool hardened;           // the modes as of mm_init
+   bool side_table;
+   bool adaptive;
+   size_t heap_secret;
+
+   // segregated lists of the bottom and top regions, same classes, and
+   // the exact-size fast bins, one per 16 byte size up to FAST_MAX
+   struct free_block_t *segregated_free_lists[14];
+   struct free_block_t *top_free_lists[14];
+   struct free_block_t *fast_bins[MM_FAST_MAX / ALIGNMENT];
+   size_t fast_bytes;
+   size_t loose_bytes;      // bytes freed onto the bottom lists since the last merge
+   size_t warm_floor;
+   size_t class_bounds[13];
+   uint32_t size_hist[2048 / ALIGNMENT];
+   size_t adapt_tick;
+   size_t adapt_bytes;      // bytes asked for since the last redraw
+
+   size_t top_min;
+   char *top_lo;            // lowest header in the top region
+   char *top_hi;            // the sentinel, end of top blocks
+   size_t top_loose;        // bytes freed onto the top lists since the last merge
+
+   uint64_t *side_start;
+   uint64_t *side_free;
+   size_t side_used;        // bitmap words that may hold set bits
+
+   mm_stats_t stats;        // allocation counters reported through mm_get_stats
+   bool space_mode;
+   size_t policy_tick;
+
+   // handle table: entry i is the caller's pointer for handle i + 1, or a
+   // free slot holding (next free index << 1) | 1. The table has its own
+   // mapping outside the heap, so it never pins the heap top against trimming
+   char **handle_table;
+   size_t handle_cap;
+   size_t handle_free;      // first free slot + 1, 0 if none
+
+   size_t check_cursor;     // where the incremental heap check resumes
+
+   // background maintenance (mm_set_background): the pass's phase, the
+   // fast bin it drains next, where its heap walk resumes, and the bytes
+   // it has drained but not merged yet
+   int maint_phase;
+   int maint_bin;
+   size_t maint_cursor;
+   size_t drained_bytes;
+
+   // persistent heaps: set once the heap is formatted, so mm_init can
+   // tell a heap file's heap from garbage or another build's layout, and
+   // the program's root pointer (mm_set_root)
+   uint64_t magic;
+   size_t layout;
+   void *root;
+
+   // shared heaps: free-list links are stored relative to link_base (the
+   // heap start; NULL for other heaps, whose links are plain pointers).
+   // The rest is this process's own, and never taken from the image
+   char *link_base;
+   struct shared_meta *shared;
+   uint64_t shared_gen;     // the image this view was loaded from
+   bool shared_locked;
+};
+
+/*
+ * Shared heaps (mm_shared_open). The segment's meta area holds the heap
+ * struct as the last process to hold the lock left it, and each process
+ * works on a private copy: taking the lock loads the image unless the
+ * process itself wrote the current one, moving its pointers by the
+ * difference between the two mappings, and releasing it stores the copy
+ * back. Stores go to the slot not in use and then flip slot, so a holder
+ * killed mid-copy leaves the last complete image behind; the next holder
+ * then rebuilds the heap from its blocks, as after a crash in a heap file.
+ */
+struct shared_meta {
+   uint64_t gen;            // bumped by every store
+   int slot;                // image[slot] is the current one
+   struct mm_heap image[2];
+};
+
+_Static_assert(sizeof(struct mm_heap) <= MM_FILE_META_SIZE, "heap state must fit a heap file");
+_Static_assert(sizeof(struct shared_meta) <= MM_FILE_META_SIZE, "shared heap state must fit its segment");
+
+#define HEAP_MAGIC 0x6d6d2d686561702dull
+#define SHARED_WAIT_MS 1000
+
+static struct mm_heap default_heap = {
+   .top_min = SIZE_MAX,
+   .top_lo = (char *)UINTPTR_MAX,
+   .top_hi = (char *)UINTPTR_MAX,
+   .class_bounds = { MM_CLASS_BOUNDS },
+};
+static struct mm_heap *cur = &default_heap;
+static struct mm_heap *main_heap = &default_heap;  // default_heap, or the one in the heap file
 
 static size_t PACK(size_t size, int alloc){
     return size | alloc;
@@ -96,12 +372,94 @@ static size_t GET(void *p){
     return *(size_t*) (p);
 }
 
+// checksum bits for the word val stored at p
+static size_t hdr_check(void *p, size_t val){
+    size_t h = (((size_t)p - (size_t)cur->link_base) ^ (val & ~(~(size_t)0 << CHECK_SHIFT)) ^ cur->heap_secret) * 0x9E3779B97F4A7C15ull;
+    return h & (~(size_t)0 << CHECK_SHIFT);
+}
+
+/*
+ * Side table layout. Two bitmaps with one bit per 16 byte granule of the
+ * heap, indexed by payload offset from heap_listp, mirror the headers:
+ * side_start marks every block start and side_free the free ones. Walks
+ * that only need boundaries and state (consolidate) scan these 64 granules
+ * per word instead of loading one header per block, and the checker uses
+ * them to catch a header a payload overrun has rewritten. Every PUT of a
+ * header updates them; code that makes a header disappear clears its bits.
+ * Toggled at runtime like hardened mode.
+ */
+static bool side_table = false;
+static const size_t SIDE_GRANULES = (size_t)1 << 36; // 1TB heap / 16
+
+static size_t side_index(void *hp) {
+    return (size_t)((char *)hp + WSIZE - cur->heap_listp) / ALIGNMENT;
+}
+
+static void side_mark(void *hp, size_t val) {
+    size_t g = side_index(hp);
+    uint64_t bit = (uint64_t)1 << (g % 64);
+    cur->side_start[g / 64] |= bit;
+    if (val & 1) {
+        cur->side_free[g / 64] &= ~bit;
+    }
+    else {
+        cur->side_free[g / 64] |= bit;
+    }
+    if (g / 64 >= cur->side_used) {
+        cur->side_used = g / 64 + 1;
+    }
+}
+
+// forgets the block starts in granules [lo, hi)
+static void side_clear(size_t lo, size_t hi) {
+    while (lo < hi) {
+        size_t w = lo / 64;
+        size_t n = 64 - lo % 64 < hi - lo ? 64 - lo % 64 : hi - lo;
+        uint64_t mask = (n == 64 ? ~(uint64_t)0 : (((uint64_t)1 << n) - 1)) << (lo % 64);
+        cur->side_start[w] &= ~mask;
+        cur->side_free[w] &= ~mask;
+        lo += n;
+    }
+}
+
+// first block start in [from, end) that is free (or allocated), else end
+static size_t side_find(size_t from, size_t end, bool want_free) {
+    // an empty range, or one past the table's end, has no bitmap words to read
+    if (from >= end) {
+        return end;
+    }
+    size_t w = from / 64;
+    uint64_t bits = cur->side_start[w] & (want_free ? cur->side_free[w] : ~cur->side_free[w]);
+    bits &= ~(uint64_t)0 << (from % 64);
+    while (bits == 0) {
+        if (++w * 64 >= end) {
+            return end;
+        }
+        bits = cur->side_start[w] & (want_free ? cur->side_free[w] : ~cur->side_free[w]);
+    }
+    size_t g = w * 64 + (size_t)__builtin_ctzll(bits);
+    return g < end ? g : end;
+}
+
+// only allocated words carry a checksum: free and realloc are where a
+// forged or stale header is used, and free-block writes stay plain
 static void PUT(void *p, size_t val){
+    if (cur->hardened && (val & 1)) {
+        val |= hdr_check(p, val);
+    }
+    if (cur->side_table) {
+        side_mark(p, val);
+    }
     *(size_t *)(p) = val;
 }
 
+// the word at p without its checksum bits, ready to PUT back
+static size_t GET_PLAIN(void *p) {
+    return GET(p) & ~(~(size_t)0 << CHECK_SHIFT);
+}
+
 static size_t GET_SIZE(void *p) {
-    return GET(p) & ~0x7;
+    return GET(p) & SIZE_MASK;
 }
 
 static int GET_ALLOC(void *p) {
@@ -139,12 +497,29 @@ struct block_meta{
 
 //function declarations so that i can declare in any order i desire
 static void *extend_heap(size_t words);
+static void *malloc_block(size_t size, int hint);
+static bool side_reserve(void);
+static bool top_open(void);
+static void policy_update(void);
+static void adapt_classes(void);
+static bool prewarm(void);
+static bool heap_reattach(bool clean);
+static void shared_lock(void);
+static void shared_store(void);
+static char *first_hdr(void);
+static bool check_block(int line, char *hp);
 static void *find_fit(size_t size);
 static void place(void *bp, size_t asize);
 static void *coalesce(void *bp);
 size_t get_size(void *ptr);
 bool is_free(void *ptr);
 void merge_blocks(void *oldptr, void *next_block);
+static bool in_heap(const void* p);
+static bool aligned(const void* p);
+static bool maint_enter(void);
+static void maint_leave(bool *held);
+static bool maint_offload(void);
+static void maint_start(void);
 
 // woohoo! this one is the most important one. used to keep track of free blocks in heap
 typedef struct free_block_t{
@@ -153,11 +528,111 @@ typedef struct free_block_t{
    struct free_block_t *prevBestFit;
 } free_block_t;
 
-//set head pointer to first free block in free list
-free_block_t *head = NULL;
+// reports a corrupted or misused block and stops (hardened mode only)
+static void heap_abort(const char *what, void *p) {
+   fprintf(stderr, "mm: %s at %p\n", what, p);
+   abort();
+}
+
+// whether the checksum bits of the header/footer word at p match; a free
+// word has none, so its top bits must be clear
+static bool word_ok(void *p) {
+   size_t val = GET(p);
+   size_t bits = val & (~(size_t)0 << CHECK_SHIFT);
+   return bits == ((val & 1) ? hdr_check(p, val) : 0);
+}
+
+// verifies the checksum bits of the header/footer word at p
+static void check_word(void *p) {
+   if (!word_ok(p)) {
+       heap_abort("corrupted block header", p);
+   }
+}
+
+// free-list links go through these so hardened mode can encode them.
+// The encoding is an add of the heap secret rather than glibc style
+// xor-with-address: the subtract folds into the addressing of the next
+// load, so the list walk in malloc does not get a longer dependency chain.
+// A shared heap's links are offsets from link_base underneath, with 0
+// still meaning NULL, since no block starts at the heap start.
+static free_block_t *get_next(free_block_t *b) {
+   size_t link = (size_t)b->next;
+   if (cur->hardened) {
+       link -= cur->heap_secret;
+   }
+   if (cur->link_base != NULL && link != 0) {
+       link += (size_t)cur->link_base;
+   }
+   return (free_block_t *)link;
+}
+
+static void set_next(free_block_t *b, free_block_t *next) {
+   size_t link = (size_t)next;
+   if (cur->link_base != NULL && next != NULL) {
+       link -= (size_t)cur->link_base;
+   }
+   if (cur->hardened) {
+       link += cur->heap_secret;
+   }
+   b->next = (free_block_t *)link;
+}
+
+// the segregated lists a free block at hp belongs on
+static free_block_t **lists_of(void *hp) {
+   return (char *)hp >= cur->top_lo ? cur->top_free_lists : cur->segregated_free_lists;
+}
+
+/*
+ * Speed/space policy. Every POLICY_PERIOD mallocs and frees the controller
+ * compares the live bytes with the heap size. Once space_above percent of
+ * the heap is live the next growth is close, and it switches to space
+ * mode: frees skip the fast bins, take_fit picks the best fit in a class
+ * instead of the first, the heap is consolidated as soon as recent frees
+ * could serve a request, and free space at the heap end is trimmed. Below
+ * speed_below percent there is headroom again and it switches back.
+ */
+static const size_t POLICY_PERIOD = 1024;
+static unsigned speed_below = 85;
+static unsigned space_above = 90;
+static const size_t SPACE_MERGE_SHARE = 32; // space mode merges once 1/32 of the heap is loose
 
-//array of free lists
-free_block_t *segregated_free_lists[14];
+/*
+ * Background maintenance (mm_set_background). A thread started by mm_init
+ * takes the merging off the request path of the default heap: a malloc
+ * miss that would call consolidate() flags a pass and grows the heap
+ * instead, and every period the thread runs the pass flagged, one for a
+ * fast-bin backlog of 1/SPACE_MERGE_SHARE of the heap, or one asked for
+ * with mm_maintain. A pass runs in steps of at most MAINT_STEP blocks,
+ * each under maint_lock, which every entry point takes while the thread
+ * runs, so no request waits behind more than one step. The pass first
+ * drains the fast bins, marking each block DRAIN_BITS (free, and FAST_BIT
+ * keeps realloc and xallocx off it), then walks the heap from maint_cursor
+ * merging each run of drained blocks onto the lists, or trimming it if it
+ * ends the heap. A consolidate() in between takes the drained blocks
+ * along and ends the pass.
+ */
+static const int MAINT_IDLE = 0;
+static const int MAINT_DRAIN = 1;
+static const int MAINT_MERGE = 2;
+static const size_t MAINT_STEP = 256;
+static const size_t DRAIN_BITS = 0x6; // FAST_BIT | GROW_BIT on a free block
+static unsigned maint_period = 0;     // microseconds, 0 = no thread
+static bool maint_running = false;
+static bool maint_wanted = false;     // a miss is waiting for a pass
+static bool maint_ready = false;      // maint_lock made recursive, fork handlers set
+static pthread_t maint_thread;
+static pthread_mutex_t maint_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t maint_cond = PTHREAD_COND_INITIALIZER;
+
+static int fast_index(size_t size) {
+   return (int)(size / ALIGNMENT) - 1;
+}
+
+// heap checker state: per-call block budget (0 = whole heap) and the
+// scratch bitmap used by full checks; each heap has its own cursor
+static size_t check_budget = 0;
+static unsigned char *check_map = NULL;
+static size_t check_map_len = 0;
 
 
 //check if block is free
@@ -167,49 +642,21 @@ bool is_free(void *ptr) {
 
 // Helper function to get the list index range
 //! adding any more results in a decrease in utilization by 8 pts.
+// the boundaries come from mm_tune.h, where autotune.pl can move them,
+// and with adaptive classes from the request sizes seen so far
 int get_list_index(size_t size) {
-   if (size <= 32) {
-       return 0;
-   }
-   else if (size <= 64) {
-       return 1;
-   }
-   else if (size <= 128) {
-       return 2;
-   }
-   else if (size <= 256) {
-       return 3;
-   }
-   else if (size <= 512) {
-       return 4;
-   }
-   else if (size <= 1024) {
-       return 5;
-   }
-   else if (size <= 2048) {
-       return 6;
-   }
-   else if (size <= 4096) {
-       return 7;
-   }
-   else if (size <= 8192) {
-       return 8;
-    }
-   else if (size <= 16384) {
-       return 9;
+   int i = 0;
+   if (!cur->adaptive) {
+       // fixed bounds are constants: a branch-free count of those below size
+       for (int k = 0; k < 13; k++) {
+           i += size > default_bounds[k];
+       }
+       return i;
    }
-   else if (size <= 32768) {
-       return 10;
+   while (i < 13 && size > cur->class_bounds[i]) {
+       i++;
    }
-    else if (size <= 65536) {
-         return 11;
-    }
-    else if (size <= 131072) {
-         return 12;
-    }
-    else {
-         return 13;
-    }
+   return i;
 }
 
 //places allocated block & splits (somehow worse than split due to split being byte based)
@@ -244,27 +691,27 @@ static void *coalesce(void*bp)
     int index = get_list_index(size);
     free_block_t *curr = (free_block_t *)bp;
     free_block_t *prev = NULL;
-    free_block_t *element = segregated_free_lists[index];
+    free_block_t *element = cur->segregated_free_lists[index];
 
     while (element != NULL && element != curr) {
         prev = element;
-        element = element->next;
+        element = get_next(element);
     }
 
     if (element == curr) {
         if (prev == NULL) {
-            segregated_free_lists[index] = element->next;
+            cur->segregated_free_lists[index] = get_next(element);
         } 
         else {
-        prev->next = element->next;
+        set_next(prev, get_next(element));
         }
     }
     
    //case 1
    if (prev_alloc && next_alloc){
        index = get_list_index(size);
-       curr -> next = segregated_free_lists[index];
-       segregated_free_lists[index] = curr;
+       set_next(curr, cur->segregated_free_lists[index]);
+       cur->segregated_free_lists[index] = curr;
        return bp;
    }
    
@@ -277,19 +724,19 @@ static void *coalesce(void*bp)
        index = get_list_index(GET_SIZE(HDRP(next_block)));
        free_block_t *nextfree = (free_block_t *)next_block;
        prev = NULL;
-       element = segregated_free_lists[index];
+       element = cur->segregated_free_lists[index];
 
        while(element != NULL && element != nextfree){
            prev = element;
-           element = element -> next;
+           element = get_next(element);
        }
 
        if (element == nextfree){
             if(prev == NULL){
-                segregated_free_lists[index] = element -> next;
+                cur->segregated_free_lists[index] = get_next(element);
             }
             else{
-                prev -> next = element -> next;
+                set_next(prev, get_next(element));
             }
        }
        PUT(HDRP(bp), PACK(size, 0));
@@ -307,19 +754,19 @@ static void *coalesce(void*bp)
        index = get_list_index(GET_SIZE(HDRP(prev_block)));
        free_block_t *prevfree = (free_block_t *)prev_block;
        prev = NULL;
-       element = segregated_free_lists[index];
+       element = cur->segregated_free_lists[index];
 
        while(element != NULL && element != prevfree){
            prev = element;
-           element = element -> next;
+           element = get_next(element);
        }
 
        if (element == prevfree){
            if(prev == NULL){
-               segregated_free_lists[index] = element -> next;
+               cur->segregated_free_lists[index] = get_next(element);
            }
            else{
-               prev -> next = element -> next;
+               set_next(prev, get_next(element));
            }
        }
        PUT(HDRP(prev_block), PACK(size, 0));
@@ -337,36 +784,36 @@ static void *coalesce(void*bp)
        index = get_list_index(GET_SIZE(HDRP(prev_block)));
        free_block_t *prevfree = (free_block_t *)prev_block;
        prev = NULL;
-       element = segregated_free_lists[index];
+       element = cur->segregated_free_lists[index];
 
        while(element != NULL && element != prevfree){
            prev = element;
-           element = element -> next;
+           element = get_next(element);
        }
 
        if (element == prevfree){
            if(prev == NULL){
-               segregated_free_lists[index] = element -> next;
+               cur->segregated_free_lists[index] = get_next(element);
            }
            else{
-               prev -> next = element -> next;
+               set_next(prev, get_next(element));
            }
        }
        index = get_list_index(GET_SIZE(HDRP(next_block)));
        free_block_t *nextfree = (free_block_t *)next_block;
        prev = NULL;
-       element = segregated_free_lists[index];
+       element = cur->segregated_free_lists[index];
 
        while(element != NULL && element != nextfree){
            prev = element;
-           element = element -> next;
+           element = get_next(element);
        }
        if (element == nextfree){
            if(prev == NULL){
-               segregated_free_lists[index] = element -> next;
+               cur->segregated_free_lists[index] = get_next(element);
            }
            else{
-               prev -> next = element -> next;
+               set_next(prev, get_next(element));
            }
        }
        PUT(HDRP(prev_block), PACK(size, 0));
@@ -375,39 +822,226 @@ static void *coalesce(void*bp)
    }
    index = get_list_index(GET_SIZE(HDRP(bp)));
    curr = (free_block_t *)bp;
-   curr->next = segregated_free_lists[index];
-   segregated_free_lists[index] = curr;
+   set_next(curr, cur->segregated_free_lists[index]);
+   cur->segregated_free_lists[index] = curr;
 
    return bp;
 }
 
-// Helper function that splits a free block if excess space is 32 bytes or more, adding the remainder to the free list.
+// Helper function that splits a free block if excess space is SPLIT_MIN bytes or more, adding the remainder to the free list.
 static void split(size_t size, free_block_t *curblock) {
    size_t free_size = GET_SIZE(&curblock->header);
    size_t diff = free_size - size;
-   if (diff >= 32) {  
-       PUT((char *)curblock, PACK(size, 1));
+   if (diff >= SPLIT_MIN) {  
+       // remainder first: a heap file or shared heap whose writer dies in
+       // between still has headers that tile it
        PUT((char *)curblock + size, PACK(diff, 0));
+       PUT((char *)curblock, PACK(size, 1));
 
        int index = get_list_index(diff);
+       free_block_t **lists = lists_of(curblock);
        free_block_t *next_block = (free_block_t *)((char *)curblock + size);
-       next_block->next = segregated_free_lists[index];
-       segregated_free_lists[index] = next_block;
+       set_next(next_block, lists[index]);
+       lists[index] = next_block;
    } else {
        PUT(curblock, PACK(free_size, 1));  
    }
 }
 
+// removes a free block from its segregated list
+static void unlink_free(free_block_t *block) {
+   int index = get_list_index(GET_SIZE(&block->header));
+   free_block_t **lists = lists_of(block);
+   free_block_t *prev = NULL;
+   free_block_t *element = lists[index];
+
+   while (element != NULL && element != block) {
+       prev = element;
+       element = get_next(element);
+   }
+   if (element == block) {
+       if (prev == NULL) {
+           lists[index] = get_next(element);
+       }
+       else {
+           set_next(prev, get_next(element));
+       }
+   }
+}
+
+// the free block at hp has just been taken into the block at into, so
+// neither heap walk may stay parked on its header
+static void absorbed(char *hp, char *into) {
+   cur->check_cursor = 0;
+   if (cur->maint_cursor == (size_t)(hp - cur->heap_listp - WSIZE)) {
+       cur->maint_cursor = (size_t)(into - cur->heap_listp - WSIZE);
+   }
+}
+
+// empties one region's lists, and for the bottom region the fast bins,
+// ahead of a rebuild by append_run
+static void clear_lists(free_block_t **lists, free_block_t **tails) {
+   for (int i = 0; i < 14; i++) {
+       lists[i] = NULL;
+       tails[i] = NULL;
+   }
+   if (lists == cur->top_free_lists) {
+       cur->top_loose = 0;
+       return;
+   }
+   for (int i = 0; i < FAST_BINS; i++) {
+       cur->fast_bins[i] = NULL;
+   }
+   cur->fast_bytes = 0;
+   cur->loose_bytes = 0;
+   cur->warm_floor = 0;
+   // the rebuild merges the drained blocks too, which ends the pass
+   cur->maint_phase = MAINT_IDLE;
+   cur->drained_bytes = 0;
+}
+
+// hands the free run at the bottom region's end back to the OS rather
+// than listing it; false if memlib would not
+static bool trim_run(char *run, size_t total) {
+   if (!mm_trim(total)) {
+       return false;
+   }
+   if (cur->side_table) {
+       side_clear(side_index(run), side_index(run + total));
+   }
+   size_t offset = (size_t)(run - cur->heap_listp - WSIZE);
+   if (cur->maint_cursor > offset) {
+       cur->maint_cursor = offset;
+   }
+   return true;
+}
+
+// makes run a single free block of total bytes at the tail of its list,
+// so lists rebuilt in one heap walk come out in address order. tails
+// belongs to the region run is in
+static void append_run(char *run, size_t total, free_block_t **tails) {
+   if (cur->side_table) {
+       side_clear(side_index(run) + 1, side_index(run) + total / ALIGNMENT);
+   }
+   PUT(run, PACK(total, 0));
+
+   int index = get_list_index(total);
+   free_block_t *block = (free_block_t *)run;
+   set_next(block, NULL);
+   if (tails[index]) {
+       set_next(tails[index], block);
+   }
+   else {
+       lists_of(run)[index] = block;
+   }
+   tails[index] = block;
+}
+
+// merges each run of adjacent free blocks in [hp, end) into one block on
+// the lists, after clear_lists has emptied them. With trim_end a run that
+// reaches end is trimmed instead
+static void merge_runs(char *hp, char *end, free_block_t **tails, bool trim_end) {
+   // side table: a free run goes from a free block start to the next
+   // allocated one, and allocated blocks are never touched
+   if (cur->side_table) {
+       size_t g = side_index(hp);
+       size_t g_end = side_index(end);
+       while ((g = side_find(g, g_end, true)) < g_end) {
+           size_t a = side_find(g, g_end, false);
+           char *run = cur->heap_listp + g * ALIGNMENT - WSIZE;
+           if (!(trim_end && a == g_end && trim_run(run, (a - g) * ALIGNMENT))) {
+               append_run(run, (a - g) * ALIGNMENT, tails);
+           }
+           g = a;
+       }
+       return;
+   }
+
+   while (hp < end) {
+       if (GET_ALLOC(hp)) {
+           hp += GET_SIZE(hp);
+           continue;
+       }
+       char *run = hp;
+       size_t total = 0;
+       while (hp < end && !GET_ALLOC(hp)) {
+           total += GET_SIZE(hp);
+           hp += GET_SIZE(hp);
+       }
+       if (!(trim_end && hp == end && trim_run(run, total))) {
+           append_run(run, total, tails);
+       }
+   }
+}
+
+/*
+ * consolidate: empties the fast bins and merges every run of adjacent free
+ * blocks in one pass over the heap, then rebuilds the segregated lists in
+ * address order. Called when a request too big for the fast bins would
+ * otherwise grow the heap, or in space mode any request that recent frees
+ * could serve. Space mode also trims a free run at the heap end.
+ */
+static void consolidate(void) {
+   free_block_t *tails[14];
+
+   clear_lists(cur->segregated_free_lists, tails);
+   merge_runs(cur->heap_listp + WSIZE, (char *)mm_heap_hi() + 1, tails, cur->space_mode);
+   // merged runs removed block boundaries the incremental checker may be parked on
+   cur->check_cursor = 0;
+}
+
+// consolidate() for the top region, whose blocks are few and large, so
+// its walk is cheap. Called when enough has been freed there since the
+// last merge to serve a request
+static void consolidate_top(void) {
+   free_block_t *tails[14];
+
+   clear_lists(cur->top_free_lists, tails);
+   merge_runs(cur->top_lo, cur->top_hi, tails, false);
+   cur->check_cursor = 0;
+}
+
+// unlinks and returns the first block in lists that fits asize
+static free_block_t *take_fit(size_t asize, free_block_t **lists) {
+   int index = get_list_index(asize);
+   free_block_t *prevBestFit = NULL;
+   free_block_t *currBestFit = NULL;
+
+   // Search for the best fit in segregated lists starting from the right index based on set from above.
+   // speed mode takes the first block that fits, space mode the smallest in the class
+   for (int i = index; i < 14 && !currBestFit; i++) {
+       free_block_t *current = lists[i];
+       free_block_t *prev = NULL;
+       
+       // Iterate through the list
+       while (current) {
+           size_t csize = GET_SIZE(&current->header);
+           if (csize >= asize && (!currBestFit || csize < GET_SIZE(&currBestFit->header))) {
+               currBestFit = current;
+               prevBestFit = prev;
+               if (!cur->space_mode || csize == asize) {
+                   break;
+               }
+           }
+           prev = current;
+           current = get_next(current);
+       }
+   }
+   if (currBestFit){
+       if(prevBestFit){
+           set_next(prevBestFit, get_next(currBestFit));
+       }
+       else{
+           lists[get_list_index(GET_SIZE(&currBestFit->header))] = get_next(currBestFit);
+       }
+   }
+   return currBestFit;
+}
+
 //check for corruption
 void validate_heap() {
-   uint64_t* curr = (uint64_t*)mm_heap_lo();
-   while (curr < (uint64_t*)mm_heap_hi()) {
-       size_t block_size = *curr & ~1;
-       if (block_size < ALIGNMENT || (uintptr_t)curr % ALIGNMENT != 0) {
-           printf("Heap corruption detected at %p\n", (void*)curr);
-           exit(1);
-       }
-       curr = (uint64_t*)((char*)curr + block_size);
+   if (!mm_checkheap(__LINE__)) {
+       exit(1);
    }
 }
 
@@ -431,7 +1065,7 @@ static void *extend_heap(size_t size) {
 static void *find_fit(size_t asize){ 
    void *bp;
    
-   for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)){
+   for (bp = cur->heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)){
        if (!GET_ALLOC(HDRP(bp)) && (asize <= GET_SIZE(HDRP(bp)))){
            return bp;
        }
@@ -459,105 +1093,625 @@ void merge_blocks(void *oldptr, void *next_block){
 bool mm_init(void)
 {
     // IMPLEMENT THIS
-   if((heap_listp=mm_sbrk(8))==(void*)-1){
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   // a heap file holds the default heap's state, and maybe a whole heap
+   if (cur == main_heap) {
+       struct mm_heap *meta = mm_file_meta();
+       main_heap = cur = meta != NULL ? meta : &default_heap;
+       if (meta != NULL && mm_file_state() != MM_FILE_NEW) {
+           if (!heap_reattach(mm_file_state() == MM_FILE_CLEAN)) {
+               return false;
+           }
+           if (maint_period != 0) {
+               maint_start();
+           }
+           return true;
+       }
+   }
+   cur->hardened = hardened;
+   // the bitmaps live outside the heap file, so its heap goes without
+   cur->side_table = side_table && mm_file_meta() == NULL;
+   cur->adaptive = adaptive;
+   if((cur->heap_listp=mm_sbrk(8))==(void*)-1){
        return false;}
+   cur->link_base = cur->shared != NULL ? cur->heap_listp : NULL;
+   cur->region_end = (char *)mm_top_hi() + 1;
+   if (cur->side_table && !side_reserve()) {
+       return false;
+   }
+
+   cur->top_lo = cur->top_hi = (char *)UINTPTR_MAX;
+   cur->top_min = SIZE_MAX;
+   if (two_ended) {
+       if (!top_open()) {
+           return false;
+       }
+       cur->top_min = TOP_MIN;
+   }
+   cur->top_loose = 0;
 
    for(int i = 0; i < 14; i++) {
-       segregated_free_lists[i] = NULL;
+       cur->segregated_free_lists[i] = NULL;
+       cur->top_free_lists[i] = NULL;
+   }
+   for(int i = 0; i < FAST_BINS; i++) {
+       cur->fast_bins[i] = NULL;
+   }
+   cur->fast_bytes = 0;
+   cur->check_cursor = 0;
+   if (cur->handle_table != NULL) {
+       munmap(cur->handle_table, cur->handle_cap * sizeof(char *));
+   }
+   cur->handle_table = NULL;
+   cur->handle_cap = 0;
+   cur->handle_free = 0;
+   mm_stats_t empty = {0};
+   cur->stats = empty;
+   cur->space_mode = false;
+   cur->policy_tick = 0;
+   cur->loose_bytes = 0;
+   memcpy(cur->class_bounds, default_bounds, sizeof(cur->class_bounds));
+   memset(cur->size_hist, 0, sizeof(cur->size_hist));
+   cur->adapt_tick = 0;
+   cur->adapt_bytes = 0;
+   cur->warm_floor = 0;
+   // the secret only has to differ between heaps and runs, ASLR does the rest
+   cur->heap_secret = ((size_t)cur->heap_listp ^ ((size_t)&cur->heap_listp << 16) ^ (size_t)getpid()) * 0x9E3779B97F4A7C15ull;
+   cur->maint_phase = MAINT_IDLE;
+   cur->maint_cursor = 0;
+   cur->drained_bytes = 0;
+   cur->root = NULL;
+   if (!prewarm()) {
+       return false;
+   }
+   cur->layout = sizeof(struct mm_heap);
+   cur->magic = HEAP_MAGIC;
+   // the maintenance thread looks after the default heap only
+   if (cur == main_heap && maint_period != 0) {
+       maint_start();
    }
    return true;
 }
 
-
-
-
-
 /*
- * malloc
+ * heap_reattach: mm_init on a heap file that holds a heap already. Its
+ * state is all in the file; only what belonged to the last process is
+ * dropped: the handle table, whose blocks become plain ones, and the
+ * checker's and maintenance pass's places. A heap that was not shut down
+ * cleanly has every header checked, its lists and fast bins rebuilt by a
+ * consolidation, and its live byte count recounted. False if the file's
+ * heap is another layout or a header is damaged. Shared heaps come here
+ * too, when a process died holding the lock
  */
-void* malloc(size_t size)
+static bool heap_reattach(bool clean)
 {
-    // IMPLEMENT THIS
-   if (size == 0){
-       return NULL;
+   cur->region_end = (char *)mm_top_hi() + 1;
+   bool top = cur->top_hi != (char *)UINTPTR_MAX;
+   if (!clean && cur->magic == HEAP_MAGIC) {
+       // the top region's bound may be a step ahead of the heap's: an
+       // area without its block yet, or a trim not recorded here
+       char *want = top ? cur->top_lo : (char *)mm_top_hi() + 1;
+       if ((char *)mm_top_lo() < want) {
+           mm_trim_top((size_t)(want - (char *)mm_top_lo()));
+       }
+       else if (top && (char *)mm_top_lo() > want && (char *)mm_top_lo() <= cur->top_hi) {
+           cur->top_lo = mm_top_lo();
+       }
+   }
+   if (cur->magic != HEAP_MAGIC || cur->layout != sizeof(struct mm_heap) ||
+       cur->heap_listp != mm_heap_lo() ||
+       (top ? cur->top_lo != mm_top_lo() || cur->top_hi + WSIZE != (char *)mm_top_hi() + 1
+            : mm_top_lo() != (char *)mm_top_hi() + 1)) {
+       return false;
+   }
+   cur->check_cursor = 0;
+   cur->maint_phase = MAINT_IDLE;
+   cur->maint_cursor = 0;
+   if (clean && cur->handle_cap == 0) {
+       return true;
    }
 
-
-   size_t asize = align(size + 8);
-   //free_block_t *curr = head;
-
-   //int iterations = 0;
-   int index = get_list_index(asize);
-   free_block_t *prevBestFit = NULL;
-   free_block_t *currBestFit = NULL;
-
-   // Search for the best fit in segregated lists starting from the right index based on set from above
-   for (int i = index; i < 12 && !currBestFit; i++) {
-       free_block_t *current = segregated_free_lists[i];
-       prevBestFit = NULL;
-       
-       // Iterate through the list
-       while (current) {
-           if (GET_SIZE(&current->header) >= asize) {
-               currBestFit = current;
+   char *starts[2] = { first_hdr(), cur->top_lo };
+   char *ends[2] = { (char *)mm_heap_hi() + 1, cur->top_hi };
+   size_t alloc_bytes = 0;
+   for (int r = 0; r < 2; r++) {
+       for (char *hp = starts[r]; hp < ends[r]; hp += GET_SIZE(hp)) {
+           // a crash between growing the heap and writing the new
+           // block's header leaves an unwritten tail
+           if (r == 0 && GET(hp) == 0 && mm_trim((size_t)(ends[0] - hp))) {
                break;
            }
-           prevBestFit = current;
-           current = current->next;
+           if (!check_block(__LINE__, hp)) {
+               return false;
+           }
+           if (GET_ALLOC(hp)) {
+               alloc_bytes += GET_SIZE(hp);
+               if (GET(hp) & HANDLE_BIT) {
+                   PUT(hp, GET_PLAIN(hp) & ~HANDLE_BIT);
+               }
+           }
        }
    }
-   if (currBestFit){
-       if(prevBestFit){
-           prevBestFit->next = currBestFit->next;
-       }
-       else{
-           segregated_free_lists[get_list_index(GET_SIZE(&currBestFit->header))] = currBestFit->next;
-       }
-       split(asize, currBestFit);
-       return (char *)currBestFit + 8;
+   cur->handle_table = NULL;
+   cur->handle_cap = 0;
+   cur->handle_free = 0;
+   if (!clean) {
+       consolidate();
+       consolidate_top();
+       cur->stats.alloc_bytes = alloc_bytes;
+       cur->stats.rebuilds++;
    }
-
-//! somehow take this line and swap it with coalescing alongside the bp initialization  - - no longer feels worth it or possible
-   char *bp =   mm_sbrk(asize);
-   if (bp == (void *)-1) return NULL;
-//this too   
-   PUT(bp, PACK(asize, 1)); 
-
-
-
-
-
-
-   return bp + 8;
+   return true;
 }
 
-
 /*
- * free
+ * prewarm: carves the profile's blocks out of one heap extension. Sizes
+ * that would go to the top region or be page aligned are left out, and
+ * so is whatever goes past WARM_MAX
  */
-void free(void* ptr){
-    //IMPLEMENT THIS
-    /*
-    ! THE GLORIUS SEGMENTATION FAULT MAKER
-    */ 
-   // validate_heap();
-
-   if (ptr == NULL) return;
-
-   PUT(HDRP(ptr), PACK(GET_SIZE(HDRP(ptr)), 0));
-   int index = get_list_index(GET_SIZE(HDRP(ptr)));
-   free_block_t * free = (free_block_t *) HDRP(ptr);
-   free -> next = segregated_free_lists[index];
-   segregated_free_lists[index] = free;    
+static bool prewarm(void)
+{
+   size_t total = 0;
+   size_t counts[64];
+   for (int i = 0; i < warm_sizes; i++) {
+       size_t asize = align(warm_size[i] + 8);
+       counts[i] = 0;
+       if (asize >= cur->top_min || warm_size[i] >= REMAP_MIN) {
+           continue;
+       }
+       counts[i] = warm_count[i];
+       // compared before multiplying, so a huge count cannot wrap the product
+       if (counts[i] > (WARM_MAX - total) / asize) {
+           counts[i] = (WARM_MAX - total) / asize;
+       }
+       total += asize * counts[i];
+   }
+   if (total == 0) {
+       return true;
+   }
+   char *p = mm_sbrk(total);
+   if (p == (void *)-1) {
+       return false;
+   }
+   mm_prefault(p, total);
+
+   // the sizes come sorted, and each list is built tail first so it
+   // ends up in ascending order
+   free_block_t *tails[14] = {NULL};
+   for (int i = 0; i < warm_sizes; i++) {
+       size_t asize = align(warm_size[i] + 8);
+       for (size_t n = 0; n < counts[i]; n++, p += asize) {
+           free_block_t *block = (free_block_t *)p;
+           if (asize <= FAST_MAX) {
+               PUT(p, PACK(asize, 0) | FAST_BIT);
+               set_next(block, cur->fast_bins[fast_index(asize)]);
+               cur->fast_bins[fast_index(asize)] = block;
+               cur->fast_bytes += asize;
+               continue;
+           }
+           int index = get_list_index(asize);
+           PUT(p, PACK(asize, 0));
+           set_next(block, NULL);
+           if (tails[index] == NULL) {
+               cur->segregated_free_lists[index] = block;
+           }
+           else {
+               set_next(tails[index], block);
+           }
+           tails[index] = block;
+       }
+   }
+   cur->warm_floor = cur->fast_bytes;
+   cur->stats.prewarm_bytes = total;
+   return true;
 }
 
-
+/*
+ * top_open: sets up the top region, empty but for its sentinel, the first
+ * time a block needs it
+ */
+static bool top_open(void)
+{
+   if (cur->top_hi != (char *)UINTPTR_MAX) {
+       return true;
+   }
+   char *p = mm_sbrk_top(WSIZE);
+   if (p == (void *)-1) {
+       return false;
+   }
+   // stored raw: the sentinel is no block, so not in the side table
+   *(size_t *)p = PACK(0, 1);
+   cur->top_lo = cur->top_hi = p;
+   return true;
+}
+
+/*
+ * side_reserve: maps the side table bitmaps on first use, untouched pages
+ * cost nothing, and otherwise zeroes the part the last heap used
+ */
+static bool side_reserve(void)
+{
+   size_t bytes = SIDE_GRANULES / 8;
+   if (cur->side_start == NULL) {
+       cur->side_start = mmap(NULL, 2 * bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+       if (cur->side_start == MAP_FAILED) {
+           cur->side_start = NULL;
+           return false;
+       }
+       cur->side_free = cur->side_start + bytes / sizeof(uint64_t);
+   }
+   else if (cur->side_used > 0) {
+       size_t page = mm_pagesize();
+       size_t used = (cur->side_used * sizeof(uint64_t) + page - 1) / page * page;
+       madvise(cur->side_start, used, MADV_DONTNEED);
+       madvise(cur->side_free, used, MADV_DONTNEED);
+   }
+   cur->side_used = 0;
+   return true;
+}
+
+/*
+ * mm_set_side_table: keeps block boundaries and state in the side table
+ * as well as the headers. Like hardened mode, call it before mm_init.
+ */
+void mm_set_side_table(bool on)
+{
+   side_table = on;
+}
+
+/*
+ * policy_update: the controller step. Switching to space mode consolidates
+ * at once, so the fast bins' blocks rejoin the lists and the end is trimmed
+ */
+static void policy_update(void)
+{
+   cur->policy_tick = 0;
+   size_t heap = mm_heapsize();
+   if (heap == 0) {
+       return;
+   }
+   size_t pct = cur->stats.alloc_bytes * 100 / heap;
+   if (!cur->space_mode && space_above != 0 && pct >= space_above) {
+       cur->space_mode = true;
+       cur->stats.mode_switches++;
+       consolidate();
+   }
+   else if (cur->space_mode && pct < speed_below) {
+       cur->space_mode = false;
+       cur->stats.mode_switches++;
+   }
+}
+
+/*
+ * mm_set_policy: space mode from space_above_pct percent of the heap live,
+ * speed mode again below speed_below_pct. 0 and 0 stays in speed mode.
+ * Takes effect at the next controller step.
+ */
+bool mm_set_policy(unsigned speed_below_pct, unsigned space_above_pct)
+{
+   if (space_above_pct < speed_below_pct || space_above_pct > 100) {
+       return false;
+   }
+   speed_below = speed_below_pct;
+   space_above = space_above_pct;
+   return true;
+}
+
+/*
+ * adapt_classes: redraws the classes below HIST_MAX from the histogram,
+ * and rebuilds the lists if that moved any bound
+ */
+static void adapt_classes(void)
+{
+   cur->adapt_tick = 0;
+   cur->adapt_bytes = 0;
+   int low = 0; // classes with a default bound up to HIST_MAX
+   while (low < 13 && default_bounds[low] <= HIST_MAX) {
+       low++;
+   }
+   uint64_t total = 0;
+   for (size_t i = 0; i < HIST_MAX / ALIGNMENT; i++) {
+       total += cur->size_hist[i];
+   }
+   if (low == 0 || total == 0) {
+       return;
+   }
+
+   // cut where the running count passes the next 1/low of the total; the
+   // last class below HIST_MAX ends at it, and unused ones are empty
+   size_t bounds[13];
+   memcpy(bounds, default_bounds, sizeof(bounds));
+   int n = 0;
+   uint64_t seen = 0;
+   for (size_t i = 0; i < HIST_MAX / ALIGNMENT && n < low - 1; i++) {
+       seen += cur->size_hist[i];
+       size_t size = (i + 1) * ALIGNMENT;
+       if (size >= 2 * ALIGNMENT && size < HIST_MAX && seen * (uint64_t)low >= total * (uint64_t)(n + 1)) {
+           bounds[n++] = size;
+       }
+   }
+   while (n < low) {
+       bounds[n++] = HIST_MAX;
+   }
+   for (size_t i = 0; i < HIST_MAX / ALIGNMENT; i++) {
+       cur->size_hist[i] /= 2;
+   }
+   if (memcmp(bounds, cur->class_bounds, sizeof(bounds)) == 0) {
+       return;
+   }
+
+   memcpy(cur->class_bounds, bounds, sizeof(cur->class_bounds));
+   cur->stats.class_changes++;
+   consolidate();
+   if (cur->top_lo < cur->top_hi) {
+       consolidate_top();
+   }
+}
+
+/*
+ * mm_set_adaptive_classes: lets the size classes follow the request sizes
+ * seen at run time. Call it before mm_init.
+ */
+void mm_set_adaptive_classes(bool on)
+{
+   adaptive = on;
+}
+
+/*
+ * mm_set_profile: reads a size profile for every later mm_init to carve
+ * out ahead of time; NULL drops it. Each line holds a request size and a
+ * block count, and lines starting with # are comments. Returns false,
+ * leaving no profile, if the file cannot be read or holds anything else,
+ * or a count above WARM_MAX / 16.
+ */
+bool mm_set_profile(const char *path)
+{
+   warm_sizes = 0;
+   if (path == NULL) {
+       return true;
+   }
+   FILE *f = fopen(path, "r");
+   if (f == NULL) {
+       return false;
+   }
+   char line[128];
+   bool ok = true;
+   while (ok && fgets(line, sizeof(line), f) != NULL) {
+       size_t size, count;
+       char extra;
+       if (line[0] == '#' || line[strspn(line, " \t\r\n")] == '\0') {
+           continue;
+       }
+       // a count over WARM_MAX / 16 could not be carved at any size
+       if (sscanf(line, "%zu %zu %c", &size, &count, &extra) != 2 || warm_sizes == WARM_SIZES ||
+           size > MAX_REQUEST || count > WARM_MAX / ALIGNMENT) {
+           ok = false;
+       }
+       else if (size > 0 && count > 0) {
+           warm_size[warm_sizes] = size;
+           warm_count[warm_sizes] = count;
+           warm_sizes++;
+       }
+   }
+   fclose(f);
+   if (!ok) {
+       warm_sizes = 0;
+       return false;
+   }
+   // sort by size, so that prewarm's lists come out in ascending order
+   for (int i = 1; i < warm_sizes; i++) {
+       for (int j = i; j > 0 && warm_size[j - 1] > warm_size[j]; j--) {
+           size_t t = warm_size[j];
+           warm_size[j] = warm_size[j - 1];
+           warm_size[j - 1] = t;
+           t = warm_count[j];
+           warm_count[j] = warm_count[j - 1];
+           warm_count[j - 1] = t;
+       }
+   }
+   return true;
+}
+
+/*
+ * mm_set_two_ended: serves blocks of TOP_MIN bytes and up from a region
+ * growing down from the top of the reservation. Call it before mm_init.
+ */
+void mm_set_two_ended(bool on)
+{
+   two_ended = on;
+}
+
+/*
+ * mm_set_hardened: turns hardened mode on or off. Must be called before
+ * mm_init, since the encoding of the existing heap does not change.
+ */
+void mm_set_hardened(bool on)
+{
+   hardened = on;
+}
+
+
+
+
+
+/*
+ * malloc
+ */
+void* malloc(size_t size)
+{
+    // IMPLEMENT THIS
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   if (size == 0 || size > MAX_REQUEST){
+       return NULL;
+   }
+   // large blocks start on a page so realloc can move them by remapping
+   if (size >= REMAP_MIN) {
+       return mm_memalign(mm_pagesize(), size);
+   }
+   return malloc_block(size, 0);
+}
+
+// malloc without the page alignment of large blocks. A long-lived hint
+// places the block in the top region whatever its size, a short-lived
+// one in the bottom region; without a hint the size decides
+static void *malloc_block(size_t size, int hint)
+{
+
+   size_t asize = align(size + 8);
+   //free_block_t *curr = head;
+   if (++cur->policy_tick >= POLICY_PERIOD) {
+       policy_update();
+   }
+   if (cur->adaptive) {
+       if (asize <= HIST_MAX) {
+           cur->size_hist[asize / ALIGNMENT - 1]++;
+       }
+       cur->adapt_bytes += asize;
+       if (++cur->adapt_tick >= ADAPT_MIN && cur->adapt_bytes >= mm_heapsize()) {
+           adapt_classes();
+       }
+   }
+   bool top = hint == MM_LONG_LIVED || (hint != MM_SHORT_LIVED && asize >= cur->top_min);
+
+   // same-size reuse: one pop from the exact fast bin, no split
+   if (asize <= FAST_MAX && !top) {
+       free_block_t *fast = cur->fast_bins[fast_index(asize)];
+       if (fast) {
+           cur->fast_bins[fast_index(asize)] = get_next(fast);
+           cur->fast_bytes -= asize;
+           cur->stats.alloc_bytes += asize;
+           PUT(fast, PACK(asize, 1));
+           return (char *)fast + 8;
+       }
+   }
+
+   bool keep_top = hint == MM_LONG_LIVED;
+   free_block_t **lists = top ? cur->top_free_lists : cur->segregated_free_lists;
+   free_block_t *currBestFit = take_fit(asize, lists);
+   if (!currBestFit && top && cur->top_loose >= asize &&
+       cur->top_loose >= (size_t)(cur->top_hi - cur->top_lo) / TOP_MERGE_SHARE) {
+       consolidate_top();
+       currBestFit = take_fit(asize, lists);
+   }
+   size_t fast_loose = cur->fast_bytes > cur->warm_floor ? cur->fast_bytes - cur->warm_floor : 0;
+   bool merge = asize > FAST_MAX && fast_loose >= asize;
+   if (cur->space_mode) {
+       size_t loose = fast_loose + cur->loose_bytes;
+       merge = loose >= asize && loose >= mm_heapsize() / SPACE_MERGE_SHARE;
+   }
+   // with the maintenance thread running the merge is its job, and this
+   // request grows the heap meanwhile
+   if (!currBestFit && !keep_top && merge && !maint_offload()) {
+       consolidate();
+       currBestFit = take_fit(asize, cur->segregated_free_lists);
+   }
+   // a large block may still reuse a hole at the bottom rather than grow the top
+   else if (!currBestFit && top && !keep_top) {
+       currBestFit = take_fit(asize, cur->segregated_free_lists);
+   }
+   if (currBestFit){
+       split(asize, currBestFit);
+       cur->stats.alloc_bytes += GET_SIZE(&currBestFit->header);
+       return (char *)currBestFit + 8;
+   }
+
+   // top blocks grow the top region down, everything else the heap up
+   if (top) {
+       char *bp = mm_sbrk_top(asize);
+       if (bp == (void *)-1) return NULL;
+       cur->top_lo = bp;
+       PUT(bp, PACK(asize, 1));
+       cur->stats.alloc_bytes += asize;
+       return bp + 8;
+   }
+
+//! somehow take this line and swap it with coalescing alongside the bp initialization  - - no longer feels worth it or possible
+   size_t grow = asize < GROW_CHUNK ? GROW_CHUNK : asize;
+   char *bp =   mm_sbrk(grow);
+   if (bp == (void *)-1) return NULL;
+//this too   
+   PUT(bp, PACK(grow, 1)); 
+   split(asize, (free_block_t *)bp);
+   cur->stats.alloc_bytes += GET_SIZE(bp);
+
+
+
+
+
+
+   return bp + 8;
+}
+
+
+/*
+ * free
+ */
+void free(void* ptr){
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+    //IMPLEMENT THIS
+    /*
+    ! THE GLORIUS SEGMENTATION FAULT MAKER
+    */ 
+   // validate_heap();
+
+   if (ptr == NULL) return;
+
+   if (cur->hardened) {
+       if (!in_heap(ptr) || !aligned(ptr)) {
+           heap_abort("free of invalid pointer", ptr);
+       }
+       check_word(HDRP(ptr));
+       if (!GET_ALLOC(HDRP(ptr))) {
+           heap_abort("double free", ptr);
+       }
+   }
+
+   if (++cur->policy_tick >= POLICY_PERIOD) {
+       policy_update();
+   }
+
+   size_t size = GET_SIZE(HDRP(ptr));
+   cur->stats.alloc_bytes -= size;
+   if (size <= FAST_MAX && (char *)ptr < cur->top_lo && !cur->space_mode) {
+       PUT(HDRP(ptr), PACK(size, 0) | FAST_BIT);
+       free_block_t *fast = (free_block_t *) HDRP(ptr);
+       set_next(fast, cur->fast_bins[fast_index(size)]);
+       cur->fast_bins[fast_index(size)] = fast;
+       cur->fast_bytes += size;
+       return;
+   }
+
+   // space mode: the last block goes straight back to the OS
+   if (cur->space_mode && (char *)HDRP(ptr) + size == (char *)mm_heap_hi() + 1 &&
+       trim_run(HDRP(ptr), size)) {
+       cur->check_cursor = 0;
+       return;
+   }
+
+   PUT(HDRP(ptr), PACK(size, 0));
+   int index = get_list_index(size);
+   free_block_t **lists = cur->segregated_free_lists;
+   if ((char *)ptr >= cur->top_lo) {
+       lists = cur->top_free_lists;
+       cur->top_loose += size;
+   }
+   else {
+       cur->loose_bytes += size;
+   }
+   free_block_t * free = (free_block_t *) HDRP(ptr);
+   set_next(free, lists[index]);
+   lists[index] = free;    
+}
+
+
 /*
  * realloc
  */
 void* realloc(void* oldptr, size_t size)
 {
     // IMPLEMENT THIS
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
     if (size == 0) {
         free(oldptr);
         return NULL;
@@ -566,15 +1720,104 @@ void* realloc(void* oldptr, size_t size)
     if (oldptr == NULL) {
         return malloc(size);
     }
-    void *newptr = malloc(size);
+    // too big to serve: fail before align() wraps, with the block intact
+    if (size > MAX_REQUEST) {
+        return NULL;
+    }
+    if (cur->hardened) {
+        check_word(HDRP(oldptr));
+    }
+   cur->stats.realloc_calls++;
+   size_t asize = align(size + 8);
+   size_t bsize = GET_SIZE(HDRP(oldptr));
+   bool growing = (GET(HDRP(oldptr)) & GROW_BIT) != 0;
+   bool pressure = cur->space_mode || cur->stats.alloc_bytes * 100 > mm_heapsize() * PRESSURE_PCT;
+
+   // fits already: either spare capacity from an earlier growth, which is
+   // kept unless the heap is tight, or a real shrink, which gives back the tail
+   if (asize <= bsize) {
+       cur->stats.realloc_in_place++;
+       if (pressure || !growing || asize < bsize / 2) {
+           split(asize, (free_block_t *)HDRP(oldptr));
+           cur->stats.alloc_bytes -= bsize - GET_SIZE(HDRP(oldptr));
+       }
+       return oldptr;
+   }
+
+   // last block in the heap: grow the heap under it, unless the block has
+   // become large enough to belong in the top region
+   char *next = (char *)HDRP(oldptr) + bsize;
+   bool at_end = next == (char *)mm_heap_hi() + 1;
+   if (at_end && asize < cur->top_min) {
+       if (mm_sbrk(asize - bsize) == (void *)-1) {
+           return NULL;
+       }
+       PUT(HDRP(oldptr), PACK(asize, 1) | GROW_BIT);
+       cur->stats.alloc_bytes += asize - bsize;
+       cur->stats.realloc_in_place++;
+       return oldptr;
+   }
+
+   // free neighbour on a segregated list: absorb it
+   if (!at_end && !GET_ALLOC(next) && !(GET(next) & FAST_BIT) && bsize + GET_SIZE(next) >= asize) {
+       unlink_free((free_block_t *)next);
+       if (cur->side_table) {
+           side_clear(side_index(next), side_index(next) + 1);
+       }
+       absorbed(next, HDRP(oldptr));
+       PUT(HDRP(oldptr), PACK(bsize + GET_SIZE(next), 1));
+       split(asize, (free_block_t *)HDRP(oldptr));
+       PUT(HDRP(oldptr), PACK(GET_SIZE(HDRP(oldptr)), 1) | GROW_BIT);
+       cur->stats.alloc_bytes += GET_SIZE(HDRP(oldptr)) - bsize;
+       cur->stats.realloc_in_place++;
+       return oldptr;
+   }
+
+   // has to move: a block that keeps growing gets room to grow in place
+   size_t target = asize;
+   if (growing && !pressure) {
+       target = align(asize + asize / GROW_RESERVE);
+   }
+
+   // lowest block of the top region: grow the region under it and slide
+   // the block down, which leaves no hole behind the way a move does
+   if ((char *)HDRP(oldptr) == cur->top_lo && target < REMAP_MIN) {
+       char *lo = mm_sbrk_top(target - bsize);
+       if (lo == (void *)-1) {
+           return NULL;
+       }
+       memmove(lo + WSIZE, oldptr, bsize - WSIZE);
+       if (cur->side_table) {
+           side_clear(side_index(cur->top_lo), side_index(cur->top_lo) + 1);
+       }
+       cur->top_lo = lo;
+       cur->check_cursor = 0;
+       PUT(lo, PACK(target, 1) | GROW_BIT);
+       cur->stats.alloc_bytes += target - bsize;
+       cur->stats.realloc_copied += bsize - WSIZE;
+       return lo + WSIZE;
+   }
+    // a block from the top region stays there
+    void *newptr = (char *)oldptr >= cur->top_lo ? mm_malloc_hint(target - WSIZE, MM_LONG_LIVED)
+                                            : malloc(target - WSIZE);
     if(!newptr){
        return NULL;
     }
-   size_t copy_size = GET_SIZE(HDRP(oldptr))- DSIZE;
+   PUT(HDRP(newptr), PACK(GET_SIZE(HDRP(newptr)), 1) | GROW_BIT);
+   size_t copy_size = bsize - DSIZE;
    if (size < copy_size) {
        copy_size = size;
    }  
-   memcpy(newptr, oldptr, copy_size);
+   // both payloads page aligned: remap the whole pages, copy the last one
+   size_t page = mm_pagesize();
+   size_t moved = copy_size & ~(page - 1);
+   if (moved == 0 || ((size_t)oldptr | (size_t)newptr) & (page - 1) ||
+       mm_remap(newptr, oldptr, moved) == NULL) {
+       moved = 0;
+   }
+   memcpy((char *)newptr + moved, (char *)oldptr + moved, copy_size - moved);
+   cur->stats.realloc_remapped += moved;
+   cur->stats.realloc_copied += copy_size - moved;
    free(oldptr);
  
    return newptr;
@@ -587,7 +1830,11 @@ void* realloc(void* oldptr, size_t size)
  */
 void* calloc(size_t nmemb, size_t size)
 {
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
     void* ptr;
+    if (size != 0 && nmemb > MAX_REQUEST / size) {
+        return NULL;
+    }
     size_t total_size = nmemb * size;
     ptr = malloc(total_size);
     if (ptr) {
@@ -597,35 +1844,1246 @@ void* calloc(size_t nmemb, size_t size)
 }
 
 /*
- * Returns whether the pointer is in the heap.
- * May be useful for debugging.
+ * mm_memalign
+ * over-allocates by alignment, then gives the bytes in front of the first
+ * aligned payload back as their own free block and trims the tail with
+ * split(). Any gap in front is a multiple of 16, so it always fits the
+ * smallest free block.
  */
-static bool in_heap(const void* p)
+void* mm_memalign(size_t alignment, size_t size)
 {
-    return p <= mm_heap_hi() && p >= mm_heap_lo();
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   if (alignment <= ALIGNMENT) {
+       return malloc(size);
+   }
+   if ((alignment & (alignment - 1)) != 0 || size == 0 ||
+       size > MAX_REQUEST || alignment > MAX_REQUEST) {
+       return NULL;
+   }
+   char *p = malloc_block(size + alignment, 0);
+   if (p == NULL) {
+       return NULL;
+   }
+   cur->stats.alloc_bytes -= GET_SIZE(HDRP(p));
+   char *q = (char *)(((size_t)p + alignment - 1) & ~(alignment - 1));
+   size_t gap = (size_t)(q - p);
+   if (gap != 0) {
+       size_t bsize = GET_SIZE(HDRP(p));
+       PUT(HDRP(q), PACK(bsize - gap, 1));
+       PUT(HDRP(p), PACK(gap, 0));
+       int index = get_list_index(gap);
+       free_block_t **lists = lists_of(HDRP(p));
+       free_block_t *lead = (free_block_t *)HDRP(p);
+       set_next(lead, lists[index]);
+       lists[index] = lead;
+   }
+   split(align(size + WSIZE), (free_block_t *)HDRP(q));
+   cur->stats.alloc_bytes += GET_SIZE(HDRP(q));
+   return q;
 }
 
 /*
- * Returns whether the pointer is aligned.
- * May be useful for debugging.
+ * mm_malloc_hint
+ * malloc for callers that know how long the block will live. Long-lived
+ * blocks are packed into the top region, opened for them if the heap is
+ * not two-ended, and short-lived ones churn at the bottom, so a temporary
+ * freed never leaves a hole pinned between permanent blocks. Blocks of
+ * REMAP_MIN and up, and calls with no single hint, are placed as malloc
+ * places them.
  */
-static bool aligned(const void* p)
+void* mm_malloc_hint(size_t size, int hint)
 {
-    size_t ip = (size_t) p;
-    return align(ip) == ip;
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   if (size == 0 || size > MAX_REQUEST) {
+       return NULL;
+   }
+   if (size >= REMAP_MIN || (hint != MM_SHORT_LIVED && hint != MM_LONG_LIVED)) {
+       return malloc(size);
+   }
+   if (hint == MM_LONG_LIVED && !top_open()) {
+       return NULL;
+   }
+   return malloc_block(size, hint);
 }
 
 /*
- * mm_checkheap
- * You call the function via mm_checkheap(__LINE__)
- * The line number can be used to print the line number of the calling
- * function wpresent tpresent was an invalid heap.
+ * mm_get_stats
+ * copies out the allocation counters, plus the current heap size
  */
-bool mm_checkheap(int line_number)
+void mm_get_stats(mm_stats_t *out)
 {
-#ifdef DEBUG
-    // Write code to check heap invariants present
-    // IMPLEMENT THIS
-#endif // DEBUG
-    return true;
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   *out = cur->stats;
+   out->heap_bytes = mm_heapsize();
+   out->mode = cur->space_mode ? MM_MODE_SPACE : MM_MODE_SPEED;
+}
+
+/*
+ * mm_set_root, mm_get_root
+ * one pointer kept with the heap's own state, so a program can find its
+ * data again in a heap file it has reattached to
+ */
+void mm_set_root(void *ptr)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   cur->root = ptr;
+}
+
+void *mm_get_root(void)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   return cur->root;
+}
+
+/*
+ * heap_enter: makes h the heap, and its region the memlib region, that
+ * the allocator works on, and returns the heap that was. A shared heap
+ * is locked and brought up to date; if its lock is broken, h is left
+ * unlocked and heap_usable says so
+ */
+static struct mm_heap *heap_enter(struct mm_heap *h)
+{
+   struct mm_heap *prev = cur;
+   cur = h;
+   mm_region_use(h->region);
+   if (h->shared != NULL) {
+       shared_lock();
+   }
+   return prev;
+}
+
+static void heap_leave(struct mm_heap *prev)
+{
+   if (cur->shared_locked) {
+       shared_store();
+       cur->shared_locked = false;
+       mm_region_unlock();
+   }
+   cur = prev;
+   mm_region_use(prev->region);
+}
+
+// whether the heap heap_enter switched to can be used
+static bool heap_usable(void)
+{
+   return cur->shared == NULL || cur->shared_locked;
+}
+
+static void *moved(void *p, ptrdiff_t delta)
+{
+   return p != NULL ? (char *)p + delta : NULL;
+}
+
+// copies the current image into cur, moving its pointers from the
+// mapping of the process that wrote it to this one's
+static void shared_load(void)
+{
+   struct shared_meta *m = cur->shared;
+   mm_region_t *region = cur->region;
+   memcpy(cur, &m->image[m->slot], sizeof(struct mm_heap));
+   cur->region = region;
+   cur->shared = m;
+   cur->shared_gen = m->gen;
+   if (cur->magic != HEAP_MAGIC) {
+       return;
+   }
+   ptrdiff_t delta = (char *)mm_heap_lo() - cur->link_base;
+   if (delta == 0) {
+       return;
+   }
+   cur->heap_listp += delta;
+   cur->region_end += delta;
+   cur->link_base += delta;
+   for (int i = 0; i < 14; i++) {
+       cur->segregated_free_lists[i] = moved(cur->segregated_free_lists[i], delta);
+       cur->top_free_lists[i] = moved(cur->top_free_lists[i], delta);
+   }
+   for (int i = 0; i < FAST_BINS; i++) {
+       cur->fast_bins[i] = moved(cur->fast_bins[i], delta);
+   }
+   if (cur->top_hi != (char *)UINTPTR_MAX) {
+       cur->top_lo += delta;
+       cur->top_hi += delta;
+   }
+   cur->root = moved(cur->root, delta);
+}
+
+// stores cur as the next image: the copy first, then the flip
+static void shared_store(void)
+{
+   struct shared_meta *m = cur->shared;
+   int next = !m->slot;
+   memcpy(&m->image[next], cur, sizeof(struct mm_heap));
+   __atomic_store_n(&m->slot, next, __ATOMIC_RELEASE);
+   cur->shared_gen = ++m->gen;
+}
+
+// takes cur's lock for heap_enter; recovers the heap if the last holder
+// died with it, and leaves the lock for good if that fails
+static void shared_lock(void)
+{
+   int rc = mm_region_lock();
+   if (rc == MM_LOCK_BROKEN) {
+       return;
+   }
+   if (rc == MM_LOCK_DIED || cur->shared_gen != cur->shared->gen) {
+       shared_load();
+   }
+   if (rc == MM_LOCK_DIED) {
+       if (cur->magic == HEAP_MAGIC && !heap_reattach(false)) {
+           fprintf(stderr, "mm: shared heap damaged by a process that died holding it\n");
+           mm_region_unlock();
+           return;
+       }
+       mm_region_consistent();
+   }
+   cur->shared_locked = true;
+}
+
+/*
+ * mm_heap_create
+ * a new, empty heap in a region of its own, with the modes set right now.
+ * The heap struct is mapped outside every heap, like the handle table
+ */
+mm_heap_t *mm_heap_create(void)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   struct mm_heap *h = mmap(NULL, sizeof(struct mm_heap), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (h == MAP_FAILED) {
+       return NULL;
+   }
+   h->region = mm_region_create();
+   if (h->region == NULL) {
+       munmap(h, sizeof(struct mm_heap));
+       return NULL;
+   }
+   struct mm_heap *prev = heap_enter(h);
+   bool ok = mm_init();
+   heap_leave(prev);
+   if (!ok) {
+       mm_heap_destroy(h);
+       return NULL;
+   }
+   return h;
+}
+
+/*
+ * mm_heap_destroy
+ * returns a heap and every block still in it to the OS at once
+ */
+void mm_heap_destroy(mm_heap_t *h)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   if (h == NULL || h == main_heap || h == cur) {
+       return;
+   }
+   if (h->side_start != NULL) {
+       munmap(h->side_start, 2 * (SIDE_GRANULES / 8));
+   }
+   if (h->handle_table != NULL) {
+       munmap(h->handle_table, h->handle_cap * sizeof(char *));
+   }
+   mm_region_destroy(h->region);
+   munmap(h, sizeof(struct mm_heap));
+}
+
+/*
+ * mm_heap_malloc, mm_heap_free, mm_heap_get_stats
+ * the global calls, on heap h. A block must go back to the heap it came from
+ */
+void *mm_heap_malloc(mm_heap_t *h, size_t size)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   struct mm_heap *prev = heap_enter(h);
+   void *p = heap_usable() ? mm_malloc(size) : NULL;
+   heap_leave(prev);
+   return p;
+}
+
+void mm_heap_free(mm_heap_t *h, void *ptr)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   struct mm_heap *prev = heap_enter(h);
+   if (heap_usable()) {
+       mm_free(ptr);
+   }
+   heap_leave(prev);
+}
+
+void mm_heap_get_stats(mm_heap_t *h, mm_stats_t *out)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   struct mm_heap *prev = heap_enter(h);
+   if (heap_usable()) {
+       mm_get_stats(out);
+   }
+   else {
+       mm_stats_t empty = {0};
+       *out = empty;
+   }
+   heap_leave(prev);
+}
+
+void mm_heap_set_root(mm_heap_t *h, void *ptr)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   struct mm_heap *prev = heap_enter(h);
+   if (heap_usable()) {
+       mm_set_root(ptr);
+   }
+   heap_leave(prev);
+}
+
+void *mm_heap_get_root(mm_heap_t *h)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   struct mm_heap *prev = heap_enter(h);
+   void *root = heap_usable() ? mm_get_root() : NULL;
+   heap_leave(prev);
+   return root;
+}
+
+/*
+ * mm_shared_open
+ * the shared heap in segment name, created size bytes long (0: memlib's
+ * default) and formatted with the modes set right now if it does not
+ * exist. A process opening it waits, up to a second, for the creator to
+ * format it. mm_heap_destroy only unmaps it from this process
+ */
+mm_heap_t *mm_shared_open(const char *name, size_t size)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   struct mm_heap *h = mmap(NULL, sizeof(struct mm_heap), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (h == MAP_FAILED) {
+       return NULL;
+   }
+   h->region = mm_region_shared(name, size);
+   if (h->region == NULL) {
+       munmap(h, sizeof(struct mm_heap));
+       return NULL;
+   }
+   mm_region_t *prev_region = mm_region_use(h->region);
+   h->shared = mm_file_meta();
+   bool created = mm_file_state() == MM_FILE_NEW;
+   mm_region_use(prev_region);
+
+   bool ok = false;
+   for (int waited = 0; !ok && waited < SHARED_WAIT_MS; waited++) {
+       struct mm_heap *prev = heap_enter(h);
+       if (!heap_usable()) {
+           heap_leave(prev);
+           break;
+       }
+       if (cur->magic == HEAP_MAGIC) {
+           ok = heap_reattach(true);
+           heap_leave(prev);
+           break;
+       }
+       if (created) {
+           ok = mm_init();
+           heap_leave(prev);
+           break;
+       }
+       heap_leave(prev);
+       usleep(1000);
+   }
+   if (!ok) {
+       mm_heap_destroy(h);
+       return NULL;
+   }
+   return h;
+}
+
+/*
+ * mm_shared_offset, mm_shared_ptr
+ * a block's position in shared heap h, the same in every process that
+ * maps it, and back again; NULL is offset 0
+ */
+size_t mm_shared_offset(mm_heap_t *h, const void *ptr)
+{
+   return ptr != NULL ? (size_t)((const char *)ptr - h->link_base) : 0;
+}
+
+void *mm_shared_ptr(mm_heap_t *h, size_t offset)
+{
+   return offset != 0 ? h->link_base + offset : NULL;
+}
+
+/*
+ * maint_enter, maint_leave
+ * every entry point holds maint_lock for its whole call while the
+ * maintenance thread runs, declaring
+ *     bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+ * The lock is recursive, so calls between entry points just nest
+ */
+static bool maint_enter(void)
+{
+   if (!maint_running) {
+       return false;
+   }
+   pthread_mutex_lock(&maint_lock);
+   return true;
+}
+
+static void maint_leave(bool *held)
+{
+   if (*held) {
+       pthread_mutex_unlock(&maint_lock);
+   }
+}
+
+// for a malloc miss that would consolidate: true if the thread merges
+// instead. The miss only flags its next wakeup: signalling it from inside
+// malloc would, on a busy core, put a context switch into the request
+static bool maint_offload(void)
+{
+   if (!maint_running || cur != main_heap) {
+       return false;
+   }
+   maint_wanted = true;
+   return true;
+}
+
+/*
+ * maint_step: one step of a maintenance pass, at most MAINT_STEP blocks;
+ * false when there is nothing left to do. An idle heap starts a pass if
+ * a miss asked for one or the fast bins hold 1/SPACE_MERGE_SHARE of it
+ */
+static bool maint_step(void)
+{
+   size_t n = 0;
+
+   if (cur->maint_phase == MAINT_IDLE) {
+       bool due = maint_wanted || cur->fast_bytes >= mm_heapsize() / SPACE_MERGE_SHARE;
+       maint_wanted = false;
+       if (!due || cur->fast_bytes == 0) {
+           return false;
+       }
+       cur->maint_phase = MAINT_DRAIN;
+       cur->maint_bin = 0;
+       cur->warm_floor = 0;
+   }
+
+   if (cur->maint_phase == MAINT_DRAIN) {
+       while (n < MAINT_STEP && cur->maint_bin < FAST_BINS) {
+           free_block_t *fast = cur->fast_bins[cur->maint_bin];
+           if (fast == NULL) {
+               cur->maint_bin++;
+               continue;
+           }
+           if (cur->hardened) {
+               check_word(&fast->header);
+           }
+           size_t size = GET_SIZE(&fast->header);
+           cur->fast_bins[cur->maint_bin] = get_next(fast);
+           cur->fast_bytes -= size;
+           cur->drained_bytes += size;
+           PUT(fast, PACK(size, 0) | DRAIN_BITS);
+           n++;
+       }
+       if (cur->maint_bin == FAST_BINS) {
+           cur->maint_phase = MAINT_MERGE;
+           cur->maint_cursor = 0;
+       }
+       return true;
+   }
+
+   // merge: each run of drained blocks becomes one listed block. A run
+   // cut short by the step limit goes on in the next step as a run of its own
+   char *base = cur->heap_listp + WSIZE;
+   char *end = (char *)mm_heap_hi() + 1;
+   char *hp = base + cur->maint_cursor;
+   while (n < MAINT_STEP && hp < end) {
+       if ((GET(hp) & (DRAIN_BITS | 1)) != DRAIN_BITS) {
+           hp += GET_SIZE(hp);
+           n++;
+           continue;
+       }
+       char *run = hp;
+       size_t total = 0;
+       while (n < MAINT_STEP && hp < end && (GET(hp) & (DRAIN_BITS | 1)) == DRAIN_BITS) {
+           total += GET_SIZE(hp);
+           hp += GET_SIZE(hp);
+           n++;
+       }
+       cur->drained_bytes -= total;
+       cur->check_cursor = 0;
+       if (hp == end && trim_run(run, total)) {
+           end = hp = run;
+           break;
+       }
+       if (cur->side_table) {
+           side_clear(side_index(run) + 1, side_index(run) + total / ALIGNMENT);
+       }
+       PUT(run, PACK(total, 0));
+       int index = get_list_index(total);
+       free_block_t *block = (free_block_t *)run;
+       set_next(block, cur->segregated_free_lists[index]);
+       cur->segregated_free_lists[index] = block;
+   }
+   if (hp >= end) {
+       cur->maint_phase = MAINT_IDLE;
+       return false;
+   }
+   cur->maint_cursor = (size_t)(hp - base);
+   return true;
+}
+
+// the maintenance thread: sleeps a period or until woken, then runs
+// passes, letting requests in between steps
+static void *maint_main(void *arg)
+{
+   pthread_mutex_lock(&maint_lock);
+   while (maint_period != 0) {
+       struct mm_heap *prev = heap_enter(main_heap);
+       bool more = maint_step();
+       heap_leave(prev);
+       if (more) {
+           pthread_mutex_unlock(&maint_lock);
+           sched_yield();
+           pthread_mutex_lock(&maint_lock);
+       }
+       else if (!maint_wanted) {
+           struct timespec t;
+           clock_gettime(CLOCK_REALTIME, &t);
+           t.tv_nsec += (long)(maint_period % 1000000) * 1000;
+           t.tv_sec += maint_period / 1000000 + t.tv_nsec / 1000000000;
+           t.tv_nsec %= 1000000000;
+           pthread_cond_timedwait(&maint_cond, &maint_lock, &t);
+       }
+   }
+   // finish the pass under way, so no drained block is left unlisted
+   struct mm_heap *prev = heap_enter(main_heap);
+   while (cur->maint_phase != MAINT_IDLE && maint_step()) {
+   }
+   heap_leave(prev);
+   pthread_mutex_unlock(&maint_lock);
+   return NULL;
+}
+
+// starts the thread for mm_init, if it is not running yet; without it
+// the heap just goes on merging inline
+static void maint_start(void)
+{
+   if (!maint_running && pthread_create(&maint_thread, NULL, maint_main, NULL) == 0) {
+       maint_running = true;
+   }
+}
+
+// fork: only the forking thread lives on in the child, which maintains
+// its heap inline from then on
+static void maint_prepare(void)
+{
+   pthread_mutex_lock(&maint_lock);
+}
+
+static void maint_parent(void)
+{
+   pthread_mutex_unlock(&maint_lock);
+}
+
+static void maint_lock_init(void)
+{
+   pthread_mutexattr_t attr;
+   pthread_mutexattr_init(&attr);
+   pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+   pthread_mutex_init(&maint_lock, &attr);
+   pthread_mutexattr_destroy(&attr);
+}
+
+static void maint_child(void)
+{
+   maint_lock_init();
+   pthread_cond_init(&maint_cond, NULL);
+   maint_running = false;
+   maint_wanted = false;
+   maint_period = 0;
+}
+
+/*
+ * mm_set_background
+ * moves the default heap's maintenance to a thread that wakes every
+ * period_us microseconds and merges what mallocs would have merged
+ * inline since. The next mm_init starts it; 0 stops it once it has
+ * finished the pass under way. Stop it before resetting the heap under mm
+ */
+void mm_set_background(unsigned period_us)
+{
+   if (period_us != 0 && !maint_ready) {
+       maint_ready = true;
+       maint_lock_init();
+       pthread_atfork(maint_prepare, maint_parent, maint_child);
+   }
+   pthread_mutex_lock(&maint_lock);
+   maint_period = period_us;
+   pthread_cond_signal(&maint_cond);
+   pthread_mutex_unlock(&maint_lock);
+   if (period_us == 0 && maint_running) {
+       pthread_join(maint_thread, NULL);
+       maint_running = false;
+       maint_wanted = false;
+   }
+}
+
+/*
+ * mm_maintain
+ * maintenance now: wakes the thread, or without one merges the heap inline
+ */
+void mm_maintain(void)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   if (!maint_offload()) {
+       consolidate();
+       return;
+   }
+   pthread_cond_signal(&maint_cond);
+}
+
+/*
+ * mm_malloc_usable_size
+ * payload bytes actually available in the block at ptr
+ */
+size_t mm_malloc_usable_size(void* ptr)
+{
+   if (ptr == NULL) {
+       return 0;
+   }
+   return GET_SIZE(HDRP(ptr)) - WSIZE;
+}
+
+/*
+ * mm_nallocx
+ * the usable size mm_malloc(size) asks for, without allocating; 0 for
+ * sizes it would refuse. Unlike jemalloc's nallocx this is a lower bound,
+ * not the exact size: blocks come in any multiple of 16 rather than in
+ * size classes, and split() leaves a remainder under SPLIT_MIN inside the
+ * block it cuts, so mm_malloc_usable_size(mm_malloc(size)) can be up to
+ * SPLIT_MIN - 16 bytes more, depending on the free block that was taken
+ */
+size_t mm_nallocx(size_t size)
+{
+   if (size == 0 || size > MAX_REQUEST) {
+       return 0;
+   }
+   return align(size + WSIZE) - WSIZE;
+}
+
+/*
+ * mm_xallocx
+ * resizes the block at ptr in place to at least size and at most
+ * size + extra bytes: it takes in a free neighbour from the segregated
+ * lists and, if the block then ends the heap, grows the heap under it.
+ * A block larger than size + extra gives back its tail. The block never
+ * moves; returns its usable size, which is below size if it could not grow
+ */
+size_t mm_xallocx(void* ptr, size_t size, size_t extra)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   if (ptr == NULL) {
+       return 0;
+   }
+   if (cur->hardened) {
+       check_word(HDRP(ptr));
+   }
+   size_t bsize = GET_SIZE(HDRP(ptr));
+   if (size == 0 || size > MAX_REQUEST) {
+       return bsize - WSIZE;
+   }
+   if (extra > MAX_REQUEST - size) {
+       extra = MAX_REQUEST - size;
+   }
+   size_t asize = align(size + WSIZE);
+   size_t want = align(size + extra + WSIZE);
+   size_t flags = GET(HDRP(ptr)) & (GROW_BIT | HANDLE_BIT);
+   size_t have = bsize;
+
+   if (asize > bsize) {
+       // fast-bin blocks only leave their bin through consolidate()
+       char *next = (char *)HDRP(ptr) + bsize;
+       char *end = (char *)mm_heap_hi() + 1;
+       size_t nsize = 0;
+       if (next != end && !GET_ALLOC(next) && !(GET(next) & FAST_BIT)) {
+           nsize = GET_SIZE(next);
+       }
+       size_t grow = 0;
+       if (next + nsize == end && bsize + nsize < want) {
+           grow = want - bsize - nsize;
+           if (mm_sbrk(grow) == (void *)-1) {
+               grow = asize > bsize + nsize ? asize - bsize - nsize : 0;
+               if (grow > 0 && mm_sbrk(grow) == (void *)-1) {
+                   return bsize - WSIZE;
+               }
+           }
+       }
+       if (bsize + nsize + grow < asize) {
+           return bsize - WSIZE;
+       }
+       if (nsize > 0) {
+           unlink_free((free_block_t *)next);
+           if (cur->side_table) {
+               side_clear(side_index(next), side_index(next) + 1);
+           }
+           absorbed(next, HDRP(ptr));
+       }
+       have = bsize + nsize + grow;
+       PUT(HDRP(ptr), PACK(have, 1));
+   }
+   if (have > want) {
+       split(want, (free_block_t *)HDRP(ptr));
+   }
+   PUT(HDRP(ptr), PACK(GET_SIZE(HDRP(ptr)), 1) | flags);
+   cur->stats.alloc_bytes += GET_SIZE(HDRP(ptr));
+   cur->stats.alloc_bytes -= bsize;
+   return GET_SIZE(HDRP(ptr)) - WSIZE;
+}
+
+/*
+ * mm_free_sized
+ * free for callers that know the requested size, e.g. C++ sized delete.
+ * A small block that is exactly the size its request rounds to goes
+ * straight onto its fast bin: one load of the raw header word against
+ * PACK(asize, 1) is the size, alloc and no-flags check at once. Blocks
+ * split with slack, grown by realloc or aligned take the normal free.
+ * Hardened mode also rejects a size larger than the block.
+ */
+void mm_free_sized(void* ptr, size_t size)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   if (ptr == NULL) return;
+
+   size_t asize = align(size + WSIZE);
+   if (cur->hardened) {
+       if (in_heap(ptr) && aligned(ptr) && GET_SIZE(HDRP(ptr)) < asize) {
+           heap_abort("sized free with wrong size", ptr);
+       }
+       free(ptr);
+       return;
+   }
+   if (asize <= FAST_MAX && GET(HDRP(ptr)) == PACK(asize, 1) && (char *)ptr < cur->top_lo &&
+       !cur->space_mode && cur->policy_tick + 1 < POLICY_PERIOD) {
+       cur->policy_tick++;
+       free_block_t *fast = (free_block_t *) HDRP(ptr);
+       PUT(fast, PACK(asize, 0) | FAST_BIT);
+       set_next(fast, cur->fast_bins[fast_index(asize)]);
+       cur->fast_bins[fast_index(asize)] = fast;
+       cur->fast_bytes += asize;
+       cur->stats.alloc_bytes -= asize;
+       return;
+   }
+   free(ptr);
+}
+
+// doubles the handle table and chains the new slots onto the free chain
+static bool handle_grow(void)
+{
+   size_t cap = cur->handle_cap ? 2 * cur->handle_cap : mm_pagesize() / sizeof(char *);
+   char **table = mmap(NULL, cap * sizeof(char *), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (table == MAP_FAILED) {
+       return false;
+   }
+   if (cur->handle_table != NULL) {
+       memcpy(table, cur->handle_table, cur->handle_cap * sizeof(char *));
+       munmap(cur->handle_table, cur->handle_cap * sizeof(char *));
+   }
+   for (size_t i = cur->handle_cap; i < cap; i++) {
+       size_t next = i + 1 < cap ? i + 2 : 0;
+       table[i] = (char *)((next << 1) | 1);
+   }
+   cur->handle_free = cur->handle_cap + 1;
+   cur->handle_table = table;
+   cur->handle_cap = cap;
+   return true;
+}
+
+/*
+ * mm_halloc
+ * allocates a relocatable block and returns its handle (0 on failure).
+ * Handles are indices into the handle table; freed slots are chained
+ * through it and reused first.
+ */
+mm_handle_t mm_halloc(size_t size)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   if (size == 0 || size > MAX_REQUEST) {
+       return 0;
+   }
+   if (cur->handle_free == 0 && !handle_grow()) {
+       return 0;
+   }
+   char *p = malloc(size + HANDLE_PAD);
+   if (p == NULL) {
+       return 0;
+   }
+   size_t index = cur->handle_free - 1;
+   cur->handle_free = (size_t)cur->handle_table[index] >> 1;
+   PUT(HDRP(p), GET_PLAIN(HDRP(p)) | HANDLE_BIT);
+   *(size_t *)p = index;
+   cur->handle_table[index] = p + HANDLE_PAD;
+   return index + 1;
+}
+
+/*
+ * mm_hderef
+ * current address of a handle's payload; valid until the next mm_compact
+ */
+void* mm_hderef(mm_handle_t h)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   return h ? cur->handle_table[h - 1] : NULL;
+}
+
+/*
+ * mm_hfree
+ * frees a handle's block and puts its slot back on the free chain
+ */
+void mm_hfree(mm_handle_t h)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   if (h == 0) {
+       return;
+   }
+   char *p = cur->handle_table[h - 1] - HANDLE_PAD;
+   if (cur->hardened && (((size_t)p & 1) || !in_heap(p) || !(GET(HDRP(p)) & HANDLE_BIT))) {
+       heap_abort("free of invalid handle", p);
+   }
+   free(p);
+   cur->handle_table[h - 1] = (char *)((cur->handle_free << 1) | 1);
+   cur->handle_free = h;
+}
+
+/*
+ * mm_compact
+ * slides handle-owned blocks down over the free space below them in one
+ * walk from the bottom of the heap, then hands the free run left at the
+ * top back with mm_trim. Ordinary blocks stay put, and so do handle blocks
+ * of REMAP_MIN and up, whose copy would cost more than the space is worth;
+ * every other free run is merged and relinked as in consolidate(). The
+ * top region of a two-ended heap is not slid: a free run at its floor is
+ * trimmed and the rest merged. Returns the bytes moved.
+ */
+size_t mm_compact(void)
+{
+   bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+   free_block_t *tails[14];
+   free_block_t *top_tails[14];
+   char *hp = cur->heap_listp + WSIZE;
+   char *end = (char *)mm_heap_hi() + 1;
+   char *run = NULL; // start of the free run below hp, if any
+   size_t moved = 0;
+
+   clear_lists(cur->segregated_free_lists, tails);
+   clear_lists(cur->top_free_lists, top_tails);
+   while (hp < end) {
+       size_t size = GET_SIZE(hp);
+       if (!GET_ALLOC(hp)) {
+           if (run == NULL) {
+               run = hp;
+           }
+           hp += size;
+           continue;
+       }
+       if (run != NULL && (GET(hp) & HANDLE_BIT) && size < REMAP_MIN) {
+           // the run moves up past the block and absorbs the bytes it left
+           size_t word = GET_PLAIN(hp);
+           if (cur->side_table) {
+               // the free block starts in the run and the block's own go
+               side_clear(side_index(run), side_index(hp) + 1);
+           }
+           memmove(run, hp, size);
+           PUT(run, word);
+           cur->handle_table[*(size_t *)(run + WSIZE)] = run + WSIZE + HANDLE_PAD;
+           moved += size;
+           run += size;
+           hp += size;
+           continue;
+       }
+       if (run != NULL) {
+           append_run(run, (size_t)(hp - run), tails);
+           run = NULL;
+       }
+       hp += size;
+   }
+   if (run != NULL && !trim_run(run, (size_t)(end - run))) {
+       append_run(run, (size_t)(end - run), tails);
+   }
+
+   char *floor = cur->top_lo;
+   while (floor < cur->top_hi && !GET_ALLOC(floor)) {
+       floor += GET_SIZE(floor);
+   }
+   if (floor > cur->top_lo && mm_trim_top((size_t)(floor - cur->top_lo))) {
+       if (cur->side_table) {
+           side_clear(side_index(cur->top_lo), side_index(floor));
+       }
+       cur->top_lo = floor;
+   }
+   // top_lo and top_hi are both UINTPTR_MAX until the top region opens
+   if (cur->top_lo < cur->top_hi) {
+       merge_runs(cur->top_lo, cur->top_hi, top_tails, false);
+   }
+   cur->check_cursor = 0;
+   cur->stats.compact_moved += moved;
+   return moved;
+}
+
+/*
+ * Returns whether the pointer is in the heap's memlib region, so the
+ * header in front of it can be read. The region is mapped end to end, so
+ * this takes no memlib call; a pointer between the two ends finds no
+ * allocated block's header there and aborts like any other stray pointer.
+ */
+static bool in_heap(const void* p)
+{
+    return (const char *)p > cur->heap_listp && (const char *)p < cur->region_end;
+}
+
+/*
+ * Returns whether the pointer is aligned.
+ * May be useful for debugging.
+ */
+static bool aligned(const void* p)
+{
+    size_t ip = (size_t) p;
+    return align(ip) == ip;
+}
+
+// prints a heap checker failure; always returns false
+static bool check_fail(int line, const char *what, const void *p)
+{
+    printf("mm_checkheap(%d): %s at %p\n", line, what, p);
+    return false;
+}
+
+// header of the first block; the word at heap_listp is alignment padding
+static char *first_hdr(void)
+{
+    return cur->heap_listp + WSIZE;
+}
+
+// whether hp lies where block headers can be, in either region
+static bool in_blocks(const char *hp)
+{
+    return (hp >= first_hdr() && hp < (char *)mm_heap_hi()) ||
+           (hp >= cur->top_lo && hp < cur->top_hi);
+}
+
+// bit of the block at hp in the checker bitmap: the bottom region's
+// granules come first, then the top region's
+static size_t check_bit(const char *hp)
+{
+    char *bottom_end = (char *)mm_heap_hi() + 1;
+    if (hp >= cur->top_lo) {
+        return (size_t)(bottom_end - first_hdr() + (hp - cur->top_lo)) / ALIGNMENT;
+    }
+    return (size_t)(hp - first_hdr()) / ALIGNMENT;
+}
+
+// checks the header at hp in isolation: alignment, size, bounds, checksum
+static bool check_block(int line, char *hp)
+{
+    char *end = hp >= cur->top_lo ? cur->top_hi : (char *)mm_heap_hi() + 1;
+    size_t size = GET_SIZE(hp);
+
+    if (!aligned(hp + WSIZE)) {
+        return check_fail(line, "misaligned block", hp);
+    }
+    if (cur->hardened ? !word_ok(hp) : (GET(hp) & ~(SIZE_MASK | HANDLE_BIT | GROW_BIT | FAST_BIT | 1)) != 0) {
+        return check_fail(line, "corrupted header", hp);
+    }
+    if (!GET_ALLOC(hp) && (GET(hp) & HANDLE_BIT)) {
+        return check_fail(line, "free block marked as handle-owned", hp);
+    }
+    if (GET_ALLOC(hp) && (GET(hp) & FAST_BIT)) {
+        return check_fail(line, "allocated block marked as fast-binned", hp);
+    }
+    if (!GET_ALLOC(hp) && (GET(hp) & (GROW_BIT | FAST_BIT)) == GROW_BIT) {
+        return check_fail(line, "free block marked as growing", hp);
+    }
+    if (size < 2*DSIZE || size % ALIGNMENT != 0) {
+        return check_fail(line, "bad block size", hp);
+    }
+    if (hp + size > end) {
+        return check_fail(line, "block runs past heap end", hp);
+    }
+    if (cur->side_table) {
+        size_t g = side_index(hp);
+        bool start = (cur->side_start[g / 64] >> (g % 64)) & 1;
+        bool is_free = (cur->side_free[g / 64] >> (g % 64)) & 1;
+        size_t next = g + size / ALIGNMENT;
+        if (!start || is_free == (bool)GET_ALLOC(hp) ||
+            (side_find(g + 1, next, true) != next || side_find(g + 1, next, false) != next)) {
+            return check_fail(line, "header disagrees with side table", hp);
+        }
+    }
+    return true;
+}
+
+// checks that a free-list link out of lists[index] points at a free block
+// of the same class and region, so every link is covered by a walk over
+// the heap
+static bool check_link(int line, free_block_t *node, free_block_t **lists, int index)
+{
+    char *hp = (char *)node;
+    if (node == NULL) {
+        return true;
+    }
+    if (!in_blocks(hp) || !aligned(hp + WSIZE)) {
+        return check_fail(line, "free-list link outside heap", node);
+    }
+    if (lists_of(hp) != lists) {
+        return check_fail(line, "free block on the other region's lists", node);
+    }
+    if (GET_ALLOC(hp)) {
+        return check_fail(line, "allocated block on free list", node);
+    }
+    if (GET(hp) & FAST_BIT) {
+        return check_fail(line, "fast-binned block on segregated list", node);
+    }
+    if (get_list_index(GET_SIZE(hp)) != index) {
+        return check_fail(line, "free block in wrong size class", node);
+    }
+    return true;
+}
+
+// same as check_link for a link out of fast bin index
+static bool check_fast_link(int line, free_block_t *node, int index)
+{
+    char *hp = (char *)node;
+    if (node == NULL) {
+        return true;
+    }
+    if (!in_blocks(hp) || hp >= cur->top_lo || !aligned(hp + WSIZE)) {
+        return check_fail(line, "fast bin link outside heap", node);
+    }
+    if (GET_ALLOC(hp) || !(GET(hp) & FAST_BIT)) {
+        return check_fail(line, "block on fast bin is not fast-binned", node);
+    }
+    if (fast_index(GET_SIZE(hp)) != index) {
+        return check_fail(line, "block on wrong fast bin", node);
+    }
+    return true;
+}
+
+// clears the bitmap bit of free-list node, failing if it was not set
+static bool check_unmark(int line, free_block_t *node)
+{
+    size_t bit = check_bit((char *)node);
+    if (!(check_map[bit / 8] & (1 << (bit % 8)))) {
+        return check_fail(line, "free-list node is not a free block or is listed twice", node);
+    }
+    check_map[bit / 8] &= ~(1 << (bit % 8));
+    return true;
+}
+
+// bitmap with one bit per 16 byte granule, grown with the heap
+static bool check_map_reserve(size_t heapsize)
+{
+    size_t len = heapsize / ALIGNMENT / 8 + 1;
+    if (len <= check_map_len) {
+        memset(check_map, 0, len);
+        return true;
+    }
+    if (check_map != NULL) {
+        munmap(check_map, check_map_len);
+    }
+    len = (len + mm_pagesize() - 1) / mm_pagesize() * mm_pagesize();
+    check_map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (check_map == MAP_FAILED) {
+        check_map = NULL;
+        check_map_len = 0;
+        return false;
+    }
+    check_map_len = len;
+    return true;
+}
+
+/*
+ * Full check: walks every block, marks free blocks in the bitmap, then
+ * walks every free list and clears the bit of each node it visits. A node
+ * whose bit is already clear is not a free block or is listed twice (this
+ * also stops cycles); any bit left over is a free block no list reaches.
+ */
+static bool check_full(int line)
+{
+    char *lo = first_hdr();
+    char *end = (char *)mm_heap_hi() + 1;
+    size_t free_blocks = 0;
+    size_t listed = 0;
+    size_t uncoalesced = 0;
+    size_t fast_total = 0;
+    size_t drained_total = 0;
+    size_t alloc_total = 0;
+    bool prev_free = false;
+
+    if (!check_map_reserve(mm_heapsize())) {
+        return check_fail(line, "no memory for checker bitmap", NULL);
+    }
+    char *starts[2] = { lo, cur->top_lo };
+    char *ends[2] = { end, cur->top_hi };
+    for (int r = 0; r < 2; r++) {
+        prev_free = false;
+        for (char *hp = starts[r]; hp < ends[r]; hp += GET_SIZE(hp)) {
+            if (!check_block(line, hp)) {
+                return false;
+            }
+            if (GET_ALLOC(hp)) {
+                alloc_total += GET_SIZE(hp);
+            }
+            else if ((GET(hp) & DRAIN_BITS) == DRAIN_BITS) {
+                // drained by the maintenance thread, on no list until merged
+                drained_total += GET_SIZE(hp);
+                uncoalesced += prev_free;
+            }
+            else {
+                size_t bit = check_bit(hp);
+                check_map[bit / 8] |= 1 << (bit % 8);
+                free_blocks++;
+                uncoalesced += prev_free;
+            }
+            prev_free = !GET_ALLOC(hp);
+        }
+    }
+
+    free_block_t **region_lists[2] = { cur->segregated_free_lists, cur->top_free_lists };
+    for (int r = 0; r < 2; r++) {
+        for (int i = 0; i < 14; i++) {
+            for (free_block_t *node = region_lists[r][i]; node != NULL;
+                 node = get_next(node)) {
+                if (!check_link(line, node, region_lists[r], i) ||
+                    !check_unmark(line, node)) {
+                    return false;
+                }
+                listed++;
+            }
+        }
+    }
+    for (int i = 0; i < FAST_BINS; i++) {
+        size_t bytes = 0;
+        for (free_block_t *node = cur->fast_bins[i]; node != NULL;
+             node = get_next(node)) {
+            if (!check_fast_link(line, node, i) || !check_unmark(line, node)) {
+                return false;
+            }
+            bytes += GET_SIZE((char *)node);
+            listed++;
+        }
+        fast_total += bytes;
+    }
+    if (alloc_total != cur->stats.alloc_bytes) {
+        printf("mm_checkheap(%d): %zu bytes allocated, stats say %zu\n",
+               line, alloc_total, cur->stats.alloc_bytes);
+        return false;
+    }
+    if (fast_total != cur->fast_bytes) {
+        printf("mm_checkheap(%d): fast bins hold %zu bytes, fast_bytes says %zu\n",
+               line, fast_total, cur->fast_bytes);
+        return false;
+    }
+    if (drained_total != cur->drained_bytes) {
+        printf("mm_checkheap(%d): %zu bytes drained, drained_bytes says %zu\n",
+               line, drained_total, cur->drained_bytes);
+        return false;
+    }
+    if (listed != free_blocks) {
+        printf("mm_checkheap(%d): %zu free blocks but %zu on free lists\n",
+               line, free_blocks, listed);
+        return false;
+    }
+    // free() does not coalesce (consolidate() does), so adjacent free
+    // blocks are legal here
+    dbg_printf("mm_checkheap(%d): %zu free blocks, %zu uncoalesced pairs\n",
+               line, free_blocks, uncoalesced);
+    return true;
+}
+
+/*
+ * Incremental check: validates check_budget blocks starting where the
+ * previous call stopped, going on into the top region and wrapping at its
+ * end, plus the link out of every free block in that slice and the list
+ * heads. Only consolidate(), mm_compact, free's trim in space mode, the
+ * realloc and xallocx paths that absorb a neighbour or slide a block and
+ * the maintenance thread's merges remove block boundaries, and they rewind
+ * the cursor, so the saved cursor stays on a header between calls.
+ */
+static bool check_slice(int line)
+{
+    char *lo = first_hdr();
+    char *end = (char *)mm_heap_hi() + 1;
+    char *hp = lo + cur->check_cursor;
+
+    for (int i = 0; i < 14; i++) {
+        if (!check_link(line, cur->segregated_free_lists[i], cur->segregated_free_lists, i) ||
+            !check_link(line, cur->top_free_lists[i], cur->top_free_lists, i)) {
+            return false;
+        }
+    }
+    for (int i = 0; i < FAST_BINS; i++) {
+        if (!check_fast_link(line, cur->fast_bins[i], i)) {
+            return false;
+        }
+    }
+    for (size_t n = 0; n < check_budget && (lo < end || cur->top_lo < cur->top_hi); n++) {
+        // bottom region end -> top region -> bottom start, skipping empty ones
+        if (hp >= end && hp < cur->top_lo) {
+            hp = cur->top_lo;
+        }
+        if (hp >= cur->top_hi) {
+            hp = lo;
+        }
+        if (hp >= end && hp < cur->top_lo) {
+            hp = cur->top_lo;
+        }
+        if (!check_block(line, hp)) {
+            return false;
+        }
+        if (!GET_ALLOC(hp) && (GET(hp) & DRAIN_BITS) != DRAIN_BITS) {
+            free_block_t *node = (free_block_t *)hp;
+            bool ok = (GET(hp) & FAST_BIT)
+                ? check_fast_link(line, get_next(node), fast_index(GET_SIZE(hp)))
+                : check_link(line, get_next(node), lists_of(hp), get_list_index(GET_SIZE(hp)));
+            if (!ok) {
+                return false;
+            }
+        }
+        hp += GET_SIZE(hp);
+    }
+    // never park on a region's end: the last block may grow over it
+    if (hp >= end && hp < cur->top_lo) {
+        hp = cur->top_lo;
+    }
+    if (hp >= cur->top_hi) {
+        hp = lo;
+    }
+    cur->check_cursor = (size_t)(hp - lo);
+    return true;
+}
+
+/*
+ * mm_set_check_budget: limits each mm_checkheap call to a slice of
+ * blocks blocks; 0 restores the full check.
+ */
+void mm_set_check_budget(size_t blocks)
+{
+    bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+    check_budget = blocks;
+    cur->check_cursor = 0;
+}
+
+/*
+ * mm_checkheap
+ * You call the function via mm_checkheap(__LINE__)
+ * The line number can be used to print the line number of the calling
+ * function wpresent tpresent was an invalid heap.
+ */
+bool mm_checkheap(int line_number)
+{
+    bool held __attribute__((cleanup(maint_leave))) = maint_enter();
+    if (check_budget == 0) {
+        return check_full(line_number);
+    }
+    return check_slice(line_number);
 }
\ No newline at end of file
@@ -1,25 +1,157 @@
+#ifndef __MM_H_
+#define __MM_H_
+
 #include <stdio.h>
 #include <stdbool.h>
 
-#ifdef DRIVER
+#ifdef __cplusplus
+extern "C" {
+#endif
 
-/* declare functions for driver tests */
+/* declare functions for driver tests; libmm.c exports the libc names */
 extern void* mm_malloc (size_t size);
 extern void mm_free (void* ptr);
 extern void* mm_realloc(void* ptr, size_t size);
 extern void* mm_calloc (size_t nmemb, size_t size);
+extern void* mm_memalign(size_t alignment, size_t size);
+extern size_t mm_malloc_usable_size(void* ptr);
+extern void mm_free_sized(void* ptr, size_t size);
+
+/* Least usable size mm_malloc(size) gives (a lower bound, unlike jemalloc's
+   nallocx); in-place resize that never moves */
+extern size_t mm_nallocx(size_t size);
+extern size_t mm_xallocx(void* ptr, size_t size, size_t extra);
 
-#else
+/* Lifetime hints: where a block goes depends on how long it will live */
+#define MM_SHORT_LIVED 0x1
+#define MM_LONG_LIVED  0x2
+extern void* mm_malloc_hint(size_t size, int hint);
+
+#ifndef DRIVER
 
 /* declare functions for interpositioning */
 extern void* malloc (size_t size);
 extern void free (void* ptr);
 extern void* realloc(void* ptr, size_t size);
 extern void* calloc (size_t nmemb, size_t size);
+extern void* reallocarray(void* ptr, size_t nmemb, size_t size);
+extern void* memalign(size_t alignment, size_t size);
+extern void* aligned_alloc(size_t alignment, size_t size);
+extern int posix_memalign(void** memptr, size_t alignment, size_t size);
+extern void* valloc(size_t size);
+extern void* pvalloc(size_t size);
+extern size_t malloc_usable_size(void* ptr);
 
 #endif
 
 extern bool mm_init(void);
 
+/* Header checksums, double-free detection and encoded free-list links */
+extern void mm_set_hardened(bool on);
+
+/* Mirror block boundaries and state in a side table of bitmaps */
+extern void mm_set_side_table(bool on);
+
+/* Serve large blocks from a second region growing down from the heap top */
+extern void mm_set_two_ended(bool on);
+
+/* Redraw the small size classes from a histogram of the request sizes */
+extern void mm_set_adaptive_classes(bool on);
+
+/* Carve the blocks a size profile lists out of the heap at each mm_init */
+extern bool mm_set_profile(const char *path);
+
+/*
+ * Speed/space policy: from space_above_pct percent of the heap live the
+ * allocator favours space, below speed_below_pct speed again
+ */
+#define MM_MODE_SPEED 0
+#define MM_MODE_SPACE 1
+extern bool mm_set_policy(unsigned speed_below_pct, unsigned space_above_pct);
+
+/*
+ * Background maintenance: a thread started by mm_init merges the default
+ * heap every period_us microseconds and on demand (mm_maintain), instead
+ * of mallocs doing it inline; 0 stops it. Stop it before mem_reset_brk
+ */
+extern void mm_set_background(unsigned period_us);
+extern void mm_maintain(void);
+
+/*
+ * Persistent heap: after mem_init_file, mm_init reattaches to the heap a
+ * previous run left in the file, checking it first if that run did not
+ * end with mem_deinit. The root pointer is kept in the heap, for finding
+ * the program's data again. Handles do not survive a restart, and the
+ * heap file's heap has no side table
+ */
+extern void mm_set_root(void *ptr);
+extern void *mm_get_root(void);
+
+/* Allocator statistics; counters restart at mm_init */
+typedef struct {
+    size_t heap_bytes;       /* current heap size */
+    size_t alloc_bytes;      /* bytes in allocated blocks, headers included */
+    size_t realloc_calls;    /* mm_realloc calls with a block and a size */
+    size_t realloc_in_place; /* ... that did not move the block */
+    size_t realloc_copied;   /* payload bytes copied by the ones that did */
+    size_t realloc_remapped; /* ... and bytes they moved by remapping pages */
+    size_t compact_moved;    /* bytes mm_compact has slid down */
+    int mode;                /* MM_MODE_SPEED or MM_MODE_SPACE right now */
+    size_t mode_switches;    /* times the policy controller changed mode */
+    size_t class_changes;    /* times adaptive classes moved their bounds */
+    size_t prewarm_bytes;    /* heap mm_init carved up for the size profile */
+    size_t rebuilds;         /* times the heap was rebuilt after a crash */
+} mm_stats_t;
+
+extern void mm_get_stats(mm_stats_t *stats);
+
+/*
+ * Heap instances. Each grows in its own memlib region and only serves its
+ * own blocks; the calls above work on the default heap. Destroying a heap
+ * frees everything in it. Modes set before mm_heap_create apply to it.
+ */
+typedef struct mm_heap mm_heap_t;
+
+extern mm_heap_t* mm_heap_create(void);
+extern void mm_heap_destroy(mm_heap_t* heap);
+extern void* mm_heap_malloc(mm_heap_t* heap, size_t size);
+extern void mm_heap_free(mm_heap_t* heap, void* ptr);
+extern void mm_heap_get_stats(mm_heap_t* heap, mm_stats_t *stats);
+extern void mm_heap_set_root(mm_heap_t* heap, void* ptr);
+extern void* mm_heap_get_root(mm_heap_t* heap);
+
+/*
+ * Shared heaps: a heap in the named shared memory segment name ("/name"),
+ * which several processes open and use with the mm_heap_* calls. Each
+ * maps it at its own address, so pointers stored in the heap must be
+ * offsets (mm_shared_offset, mm_shared_ptr); the root pointer is moved
+ * for each process. Calls are serialized by a robust process-shared
+ * lock, and a process that dies holding it leaves a heap the next caller
+ * rebuilds. mm_heap_destroy unmaps it; shm_unlink(name) removes it.
+ */
+extern mm_heap_t* mm_shared_open(const char* name, size_t size);
+extern size_t mm_shared_offset(mm_heap_t* heap, const void* ptr);
+extern void* mm_shared_ptr(mm_heap_t* heap, size_t offset);
+
+/*
+ * Relocatable blocks. mm_hderef's pointer is only good until the next
+ * mm_compact, which may move any handle's block toward the heap start.
+ */
+typedef size_t mm_handle_t;
+
+extern mm_handle_t mm_halloc(size_t size);
+extern void* mm_hderef(mm_handle_t h);
+extern void mm_hfree(mm_handle_t h);
+extern size_t mm_compact(void);
+
 /* This is for debugging.  Returns false if error encountered */
 extern bool mm_checkheap(int line_number);
+
+/* Check at most blocks blocks per mm_checkheap call (0 = whole heap) */
+extern void mm_set_check_budget(size_t blocks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MM_H_ */
@@ -0,0 +1,143 @@
+/*
+ * mm_arena.c - bump-pointer region arenas on top of the mm heap.
+ *
+ * Chunks come from mm_malloc and are kept on a singly linked list, newest
+ * first. Allocation bumps cur towards end inside the newest chunk; a
+ * request larger than a quarter of the chunk size gets a dedicated chunk
+ * on a second list, so the bump chunk is not abandoned. Both lists only
+ * ever grow at the front, so a mark is just their two heads and the bump
+ * position, and releasing it frees each list down to the marked head.
+ * A reset frees chunks that older marks point at, so it starts a new
+ * generation and releasing a mark from an older one does nothing.
+ * Like the rest of mm, arenas are not thread safe.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "mm.h"
+#include "mm_arena.h"
+
+#define ARENA_ALIGN 16
+/* chunk header and mm block header included, a default chunk is 64KB */
+#define ARENA_DEFAULT_CHUNK (64 * 1024 - 32)
+/* larger chunk sizes or requests would wrap in arena_align or the chunk size */
+#define ARENA_MAX (SIZE_MAX / 2)
+
+typedef struct chunk {
+    struct chunk *next;
+    size_t pad;                 /* keeps the payload 16-byte aligned */
+} chunk_t;
+
+struct mm_arena {
+    char *cur;                  /* next free byte in the newest chunk */
+    char *end;                  /* end of the newest chunk */
+    chunk_t *chunks;            /* bump chunks, newest first */
+    chunk_t *big;               /* dedicated chunks, newest first */
+    size_t chunk_size;          /* payload bytes per regular chunk */
+    size_t gen;                 /* bumped by every reset */
+};
+
+static size_t arena_align(size_t x)
+{
+    return (x + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/* Frees the chunks from c up to, not including, stop */
+static void free_chunks(chunk_t *c, chunk_t *stop)
+{
+    while (c != stop) {
+        chunk_t *next = c->next;
+        mm_free(c);
+        c = next;
+    }
+}
+
+mm_arena_t *mm_arena_create(size_t chunk_size)
+{
+    if (chunk_size > ARENA_MAX)
+        return NULL;
+    mm_arena_t *arena = mm_malloc(sizeof(mm_arena_t));
+    if (arena == NULL)
+        return NULL;
+    arena->cur = NULL;
+    arena->end = NULL;
+    arena->chunks = NULL;
+    arena->big = NULL;
+    arena->chunk_size = arena_align(chunk_size ? chunk_size : ARENA_DEFAULT_CHUNK);
+    arena->gen = 0;
+    return arena;
+}
+
+void *mm_arena_alloc(mm_arena_t *arena, size_t size)
+{
+    if (size > ARENA_MAX)
+        return NULL;
+    size = arena_align(size ? size : 1);
+    if (arena->cur != NULL && (size_t)(arena->end - arena->cur) >= size) {
+        void *p = arena->cur;
+        arena->cur += size;
+        return p;
+    }
+
+    /* Big request: own chunk, so the one we are bumping in is kept */
+    if (size > arena->chunk_size / 4) {
+        chunk_t *c = mm_malloc(sizeof(chunk_t) + size);
+        if (c == NULL)
+            return NULL;
+        c->next = arena->big;
+        arena->big = c;
+        return (char *)(c + 1);
+    }
+
+    chunk_t *c = mm_malloc(sizeof(chunk_t) + arena->chunk_size);
+    if (c == NULL)
+        return NULL;
+    c->next = arena->chunks;
+    arena->chunks = c;
+    arena->cur = (char *)(c + 1) + size;
+    arena->end = (char *)(c + 1) + arena->chunk_size;
+    return (char *)(c + 1);
+}
+
+mm_arena_mark_t mm_arena_mark(mm_arena_t *arena)
+{
+    mm_arena_mark_t mark = { arena->chunks, arena->big, arena->cur, arena->end, arena->gen };
+    return mark;
+}
+
+void mm_arena_release(mm_arena_t *arena, mm_arena_mark_t mark)
+{
+    /* a reset since the mark already freed everything after it */
+    if (mark.gen != arena->gen)
+        return;
+    free_chunks(arena->chunks, mark.chunks);
+    free_chunks(arena->big, mark.big);
+    arena->chunks = mark.chunks;
+    arena->big = mark.big;
+    arena->cur = mark.cur;
+    arena->end = mark.end;
+}
+
+/* Keeps the newest bump chunk, emptied, so the next phase need not malloc */
+void mm_arena_reset(mm_arena_t *arena)
+{
+    arena->gen++;
+    free_chunks(arena->big, NULL);
+    arena->big = NULL;
+    chunk_t *keep = arena->chunks;
+    if (keep == NULL)
+        return;
+    free_chunks(keep->next, NULL);
+    keep->next = NULL;
+    arena->cur = (char *)(keep + 1);
+    arena->end = (char *)(keep + 1) + arena->chunk_size;
+}
+
+void mm_arena_destroy(mm_arena_t *arena)
+{
+    if (arena == NULL)
+        return;
+    free_chunks(arena->chunks, NULL);
+    free_chunks(arena->big, NULL);
+    mm_free(arena);
+}
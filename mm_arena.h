@@ -0,0 +1,73 @@
+/*
+ * mm_arena.h - bump-pointer region arenas on top of the mm heap.
+ *
+ * An arena carves allocations out of large chunks it gets from mm_malloc.
+ * There is no per-object free: mm_arena_reset hands every chunk back to
+ * the heap at once, which suits phase-structured code that builds many
+ * objects and then drops them together. A mark taken with mm_arena_mark
+ * frees only what was allocated after it, so phases can nest. A reset
+ * already freed what any earlier mark covers, so releasing one is a no-op.
+ */
+#ifndef __MM_ARENA_H_
+#define __MM_ARENA_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mm_arena mm_arena_t;
+
+/* Position in an arena to roll back to; see mm_arena_release */
+typedef struct mm_arena_mark {
+    void *chunks;
+    void *big;
+    char *cur;
+    char *end;
+    size_t gen;                 /* resets the arena had seen */
+} mm_arena_mark_t;
+
+/* Create an arena that grows in chunk_size byte chunks (0 = default) */
+mm_arena_t *mm_arena_create(size_t chunk_size);
+
+/* 16-byte aligned allocation; NULL if the heap cannot grow */
+void *mm_arena_alloc(mm_arena_t *arena, size_t size);
+
+/* Free everything allocated since mark was taken; later marks become invalid */
+mm_arena_mark_t mm_arena_mark(mm_arena_t *arena);
+void mm_arena_release(mm_arena_t *arena, mm_arena_mark_t mark);
+
+/* Free everything allocated from the arena; the arena keeps one chunk.
+   Marks and scopes taken before the reset release nothing */
+void mm_arena_reset(mm_arena_t *arena);
+
+/* Free everything, including the arena itself */
+void mm_arena_destroy(mm_arena_t *arena);
+
+#ifdef __cplusplus
+}
+
+namespace mm {
+
+/* Frees what was allocated from the arena during the scope when it ends */
+class arena_scope {
+public:
+    explicit arena_scope(mm_arena_t *arena) : arena_(arena), mark_(mm_arena_mark(arena)) {}
+    ~arena_scope() { mm_arena_release(arena_, mark_); }
+
+    arena_scope(const arena_scope &) = delete;
+    arena_scope &operator=(const arena_scope &) = delete;
+
+    void *alloc(size_t size) { return mm_arena_alloc(arena_, size); }
+    mm_arena_t *get() const { return arena_; }
+
+private:
+    mm_arena_t *arena_;
+    mm_arena_mark_t mark_;
+};
+
+} // namespace mm
+#endif
+
+#endif /* __MM_ARENA_H_ */
@@ -0,0 +1,106 @@
+/*
+ * mm_central.c - per-class central free lists shared by thread caches.
+ *
+ * Words of a batch's first block: [0] next block in the batch, [1] next
+ * batch on the list, [2] blocks in the batch. Word 1 is read by a pop
+ * that may lose its race and find the batch already taken by another
+ * thread, so it is accessed atomically; the block is heap memory that
+ * stays mapped, and the sequence counter makes the stale value harmless.
+ */
+#include "mm_central.h"
+
+#define PTR_BITS 48
+#define PTR_MASK (((uint64_t)1 << PTR_BITS) - 1)
+
+typedef struct batch {
+    void *next_block;
+    struct batch *next_batch;
+    size_t count;
+} batch_t;
+
+static batch_t *head_ptr(uint64_t head)
+{
+    return (batch_t *)(uintptr_t)(head & PTR_MASK);
+}
+
+/* head with top as the new top batch and the sequence counter bumped */
+static uint64_t head_next(uint64_t head, batch_t *top)
+{
+    return ((head >> PTR_BITS) + 1) << PTR_BITS | ((uintptr_t)top & PTR_MASK);
+}
+
+void mm_central_init(mm_central_t *c, bool locked)
+{
+    for (int i = 0; i < MM_CENTRAL_CLASSES; i++) {
+        c->lists[i].head = 0;
+        c->lists[i].batches = 0;
+        pthread_mutex_init(&c->lists[i].lock, NULL);
+    }
+    c->locked = locked;
+}
+
+void *mm_batch_make(void *first, size_t count)
+{
+    batch_t *b = first;
+    b->next_batch = NULL;
+    b->count = count;
+    return b;
+}
+
+size_t mm_batch_count(const void *batch)
+{
+    return ((const batch_t *)batch)->count;
+}
+
+void mm_central_push(mm_central_t *c, int cls, void *batch)
+{
+    struct mm_central_list *l = &c->lists[cls];
+    batch_t *b = batch;
+    if (c->locked) {
+        pthread_mutex_lock(&l->lock);
+        b->next_batch = head_ptr(l->head);
+        l->head = (uintptr_t)b;
+        l->batches++;
+        pthread_mutex_unlock(&l->lock);
+        return;
+    }
+    uint64_t old = __atomic_load_n(&l->head, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&b->next_batch, head_ptr(old), __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&l->head, &old, head_next(old, b), true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_fetch_add(&l->batches, 1, __ATOMIC_RELAXED);
+}
+
+void *mm_central_pop(mm_central_t *c, int cls)
+{
+    struct mm_central_list *l = &c->lists[cls];
+    batch_t *b;
+    if (c->locked) {
+        pthread_mutex_lock(&l->lock);
+        b = head_ptr(l->head);
+        if (b != NULL) {
+            l->head = (uintptr_t)b->next_batch;
+            l->batches--;
+        }
+        pthread_mutex_unlock(&l->lock);
+        return b;
+    }
+    uint64_t old = __atomic_load_n(&l->head, __ATOMIC_ACQUIRE);
+    do {
+        b = head_ptr(old);
+        if (b == NULL)
+            return NULL;
+    } while (!__atomic_compare_exchange_n(&l->head, &old,
+                                          head_next(old, __atomic_load_n(&b->next_batch, __ATOMIC_RELAXED)),
+                                          true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    __atomic_fetch_sub(&l->batches, 1, __ATOMIC_RELAXED);
+    return b;
+}
+
+size_t mm_central_batches(mm_central_t *c, int cls)
+{
+    /* pops may run ahead of the pushes they took, so clamp wrapped counts */
+    size_t n = __atomic_load_n(&c->lists[cls].batches, __ATOMIC_RELAXED);
+    return (ptrdiff_t)n < 0 ? 0 : n;
+}
@@ -0,0 +1,63 @@
+/*
+ * mm_central.h - per-class central free lists shared by thread caches.
+ *
+ * A central list holds batches of free blocks of one size class. A batch
+ * is a chain of blocks linked through their first word; the first block
+ * also carries the link to the next batch and the batch's block count,
+ * so blocks need three words of payload. Thread caches refill by popping
+ * a whole batch and flush by pushing one, so a transfer costs one list
+ * operation however many blocks move.
+ *
+ * Each list is a lock-free stack whose head packs a 16-bit sequence
+ * counter above a 48-bit pointer, so a pop that raced with a pop and a
+ * push of the same batch fails its compare-and-swap instead of linking a
+ * stale next pointer (ABA). A central made with locked set uses one mutex
+ * per class instead, for comparison.
+ */
+#ifndef __MM_CENTRAL_H_
+#define __MM_CENTRAL_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Classes of 16, 32, ... 256 bytes */
+#define MM_CENTRAL_CLASSES 16
+#define MM_CENTRAL_CLASS_SIZE 16
+
+/* One list per cache line, so threads on different classes do not share one */
+struct mm_central_list {
+    uint64_t head;              /* sequence << 48 | top batch */
+    size_t batches;             /* approximate, for capping the list */
+    pthread_mutex_t lock;       /* locked centrals only */
+} __attribute__((aligned(64)));
+
+typedef struct mm_central {
+    struct mm_central_list lists[MM_CENTRAL_CLASSES];
+    bool locked;
+} mm_central_t;
+
+/* An empty central; lock-free unless locked is set */
+void mm_central_init(mm_central_t *c, bool locked);
+
+/* Chains count blocks (each linked to the next by its first word) into a batch */
+void *mm_batch_make(void *first, size_t count);
+size_t mm_batch_count(const void *batch);
+
+/* Push a batch onto class cls, or pop one (NULL if the list is empty) */
+void mm_central_push(mm_central_t *c, int cls, void *batch);
+void *mm_central_pop(mm_central_t *c, int cls);
+
+/* Batches on class cls right now, give or take the ones in flight */
+size_t mm_central_batches(mm_central_t *c, int cls);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MM_CENTRAL_H_ */
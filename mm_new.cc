@@ -0,0 +1,156 @@
+/*
+ * mm_new.cc - replaces the global operator new and delete with the mm heap.
+ *
+ * Link this file into a C++ program that is built against mm.o and every
+ * new and delete expression, including the containers' std::allocator,
+ * goes to mm. All standard forms are covered: plain, array, nothrow, the
+ * C++14 sized deletes and the C++17 std::align_val_t forms. Sized deletes
+ * hand their size to mm_free_sized, which can skip most of free()'s header
+ * work for small blocks. Alignments up to 16 are what mm_malloc gives
+ * anyway; larger ones go to mm_memalign.
+ *
+ * The heap is set up by the first allocation. Like the rest of mm this is
+ * not thread safe; multi-threaded programs should LD_PRELOAD libmm.so,
+ * which locks, and keep libstdc++'s operator new on top of its malloc.
+ */
+#include <cstddef>
+#include <new>
+
+#include "mm.h"
+#include "memlib.h"
+
+static bool heap_ready = false;
+
+static void *heap_alloc(std::size_t size, std::size_t alignment)
+{
+    if (!heap_ready) {
+        mem_init();
+        heap_ready = mm_init();
+    }
+    if (size == 0)
+        size = 1;
+    return alignment <= 16 ? mm_malloc(size) : mm_memalign(alignment, size);
+}
+
+/* Retry through the new_handler until it gives up, as the standard asks */
+static void *new_or_throw(std::size_t size, std::size_t alignment)
+{
+    for (;;) {
+        void *p = heap_alloc(size, alignment);
+        if (p != nullptr)
+            return p;
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+static void *new_or_null(std::size_t size, std::size_t alignment) noexcept
+{
+    try {
+        return new_or_throw(size, alignment);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *operator new(std::size_t size)
+{
+    return new_or_throw(size, 0);
+}
+
+void *operator new[](std::size_t size)
+{
+    return new_or_throw(size, 0);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    return new_or_null(size, 0);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return new_or_null(size, 0);
+}
+
+void *operator new(std::size_t size, std::align_val_t al)
+{
+    return new_or_throw(size, static_cast<std::size_t>(al));
+}
+
+void *operator new[](std::size_t size, std::align_val_t al)
+{
+    return new_or_throw(size, static_cast<std::size_t>(al));
+}
+
+void *operator new(std::size_t size, std::align_val_t al, const std::nothrow_t &) noexcept
+{
+    return new_or_null(size, static_cast<std::size_t>(al));
+}
+
+void *operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t &) noexcept
+{
+    return new_or_null(size, static_cast<std::size_t>(al));
+}
+
+void operator delete(void *p) noexcept
+{
+    mm_free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    mm_free(p);
+}
+
+void operator delete(void *p, std::size_t size) noexcept
+{
+    mm_free_sized(p, size);
+}
+
+void operator delete[](void *p, std::size_t size) noexcept
+{
+    mm_free_sized(p, size);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    mm_free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    mm_free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    mm_free(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+    mm_free(p);
+}
+
+void operator delete(void *p, std::size_t size, std::align_val_t) noexcept
+{
+    mm_free_sized(p, size);
+}
+
+void operator delete[](void *p, std::size_t size, std::align_val_t) noexcept
+{
+    mm_free_sized(p, size);
+}
+
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    mm_free(p);
+}
+
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+    mm_free(p);
+}
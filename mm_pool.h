@@ -0,0 +1,140 @@
+/*
+ * mm_pool.h - typed fixed-size object pools on top of the mm heap (C++).
+ *
+ * mm::pool<T> takes cache-line aligned slabs from mm_memalign and hands
+ * out T-sized slots from them. Slots have no header: a free slot holds
+ * the link of an intrusive LIFO free list, a live one holds the object.
+ * Fresh slabs are carved lazily with a bump pointer, so a new slab is not
+ * touched until its slots are used. Slabs go back to the heap when the
+ * pool is destroyed; objects still alive then are not destructed.
+ *
+ * Slabs are aligned to and sized in whole cache lines, and the pool's
+ * own control block is cache-line aligned, so two pools never share a
+ * line. Like the rest of mm, a pool is not thread safe.
+ */
+#ifndef __MM_POOL_H_
+#define __MM_POOL_H_
+
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#include "mm.h"
+
+namespace mm {
+
+static const std::size_t cache_line = 64;
+
+template <typename T>
+class alignas(cache_line) pool {
+public:
+    /* slab_bytes is rounded up to whole cache lines and at least one slot */
+    explicit pool(std::size_t slab_bytes = 16 * 1024)
+        : free_(nullptr), bump_(nullptr), end_(nullptr), slabs_(nullptr)
+    {
+        std::size_t min = header_size + slot_size;
+        if (slab_bytes < min)
+            slab_bytes = min;
+        slab_bytes_ = (slab_bytes + cache_line - 1) / cache_line * cache_line;
+    }
+
+    ~pool()
+    {
+        while (slabs_ != nullptr) {
+            slab *next = slabs_->next;
+            mm_free(slabs_);
+            slabs_ = next;
+        }
+    }
+
+    pool(const pool &) = delete;
+    pool &operator=(const pool &) = delete;
+
+    /* Raw slot for one T, or nullptr if the heap cannot grow */
+    void *allocate()
+    {
+        if (free_ != nullptr) {
+            slot *s = free_;
+            free_ = s->next;
+            return s;
+        }
+        if (bump_ == end_ && !grow())
+            return nullptr;
+        void *p = bump_;
+        bump_ += slot_size;
+        return p;
+    }
+
+    void deallocate(void *p)
+    {
+        slot *s = static_cast<slot *>(p);
+        s->next = free_;
+        free_ = s;
+    }
+
+    /* Allocate and construct a T; throws std::bad_alloc on failure */
+    template <typename... Args>
+    T *construct(Args &&... args)
+    {
+        void *p = allocate();
+        if (p == nullptr)
+            throw std::bad_alloc();
+        try {
+            return new (p) T(std::forward<Args>(args)...);
+        } catch (...) {
+            deallocate(p);
+            throw;
+        }
+    }
+
+    void destroy(T *p)
+    {
+        if (p == nullptr)
+            return;
+        p->~T();
+        deallocate(p);
+    }
+
+    static constexpr std::size_t slot_bytes() { return slot_size; }
+
+private:
+    union slot {
+        slot *next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    struct slab {
+        slab *next;
+    };
+
+    static constexpr std::size_t slot_align =
+        alignof(slot) > 16 ? alignof(slot) : 16;
+    static constexpr std::size_t slot_size =
+        (sizeof(slot) + alignof(slot) - 1) / alignof(slot) * alignof(slot);
+    static constexpr std::size_t header_size =
+        (sizeof(slab) + slot_align - 1) / slot_align * slot_align;
+
+    /* Start a new slab; its slots are handed out by the bump pointer */
+    bool grow()
+    {
+        std::size_t align = slot_align > cache_line ? slot_align : cache_line;
+        slab *s = static_cast<slab *>(mm_memalign(align, slab_bytes_));
+        if (s == nullptr)
+            return false;
+        s->next = slabs_;
+        slabs_ = s;
+        bump_ = reinterpret_cast<char *>(s) + header_size;
+        end_ = bump_ + (slab_bytes_ - header_size) / slot_size * slot_size;
+        return true;
+    }
+
+    slot *free_;
+    char *bump_;
+    char *end_;
+    slab *slabs_;
+    std::size_t slab_bytes_;
+};
+
+} // namespace mm
+
+#endif /* __MM_POOL_H_ */
@@ -0,0 +1,91 @@
+/*
+ * mm_resource.h - standard library allocator adapters for the mm heap (C++).
+ *
+ * mm::memory_resource is a std::pmr::memory_resource for pmr containers;
+ * mm::allocator<T> is a plain allocator for code written before pmr. Both
+ * send requests with at most 16-byte alignment to mm_malloc, which already
+ * returns 16-aligned payloads, and over-aligned ones to mm_memalign. Blocks
+ * go back with mm_free_sized, as sized delete does in mm_new.cc: the size
+ * passed to deallocate lets small blocks skip most of free()'s header work.
+ */
+#ifndef __MM_RESOURCE_H_
+#define __MM_RESOURCE_H_
+
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+#include "mm.h"
+
+namespace mm {
+
+/* Alignment every mm_malloc payload already has */
+static const std::size_t heap_align = 16;
+
+/* 0-byte requests still get a unique pointer, as operator new does */
+inline void *heap_allocate(std::size_t bytes, std::size_t alignment)
+{
+    if (bytes == 0)
+        bytes = 1;
+    void *p = alignment <= heap_align ? mm_malloc(bytes)
+                                      : mm_memalign(alignment, bytes);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+class memory_resource : public std::pmr::memory_resource {
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        return heap_allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override
+    {
+        mm_free_sized(p, bytes);
+    }
+
+    /* There is one mm heap, so any two mm resources are interchangeable */
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return dynamic_cast<const memory_resource *>(&other) != nullptr;
+    }
+};
+
+/* The process-wide mm resource, e.g. for std::pmr::set_default_resource */
+inline memory_resource *heap_resource() noexcept
+{
+    static memory_resource resource;
+    return &resource;
+}
+
+template <typename T>
+class allocator {
+public:
+    typedef T value_type;
+
+    allocator() noexcept {}
+    template <typename U>
+    allocator(const allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n)
+    {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_array_new_length();
+        return static_cast<T *>(heap_allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept { mm_free_sized(p, n * sizeof(T)); }
+};
+
+template <typename T, typename U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept { return true; }
+
+template <typename T, typename U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept { return false; }
+
+} // namespace mm
+
+#endif /* __MM_RESOURCE_H_ */
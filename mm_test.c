@@ -0,0 +1,355 @@
+/*
+ * mm_test.c - regression tests for mm.c corner cases the trace driver
+ * never reaches.
+ *
+ * Each test runs in a child process of its own on a fresh heap, so one
+ * that crashes or leaves the heap broken does not take the rest with it.
+ * A test returns true if it passed; mm_checkheap is run after each one.
+ * A test's setup, if it has one, runs before mm_init to pick the layout.
+ *
+ *   make check        runs them all, after building libmm.so for the
+ *                     tests of its libc names (./libmm.so)
+ *   ./mm_test NAME    runs the tests whose name starts with NAME
+ */
+#include <dlfcn.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_arena.h"
+
+#define EXPECT(cond)                                                    \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "  %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            return false;                                               \
+        }                                                               \
+    } while (0)
+
+/* Requests whose size would wrap in the allocator's arithmetic fail */
+static bool test_oversized(void)
+{
+    void *p = mm_malloc(64);
+    EXPECT(p != NULL);
+    EXPECT(mm_malloc(SIZE_MAX) == NULL);
+    EXPECT(mm_malloc(SIZE_MAX - 4000) == NULL);
+    EXPECT(mm_malloc((size_t)1 << 62) == NULL);
+    EXPECT(mm_memalign(4096, SIZE_MAX - 100) == NULL);
+    EXPECT(mm_memalign((size_t)1 << 63, 64) == NULL);
+    EXPECT(mm_calloc(SIZE_MAX / 2, 4) == NULL);
+    EXPECT(mm_calloc((size_t)1 << 32, (size_t)1 << 32) == NULL);
+    EXPECT(mm_malloc_hint(SIZE_MAX, MM_LONG_LIVED) == NULL);
+    EXPECT(mm_halloc(SIZE_MAX - 8) == 0);
+    EXPECT(mm_nallocx(SIZE_MAX) == 0);
+    mm_free(p);
+    return true;
+}
+
+/*
+ * The same through libmm.so's libc names, which also have to set ENOMEM.
+ * The library is loaded privately, so this process keeps libc's malloc.
+ */
+static bool test_libmm_oversized(void)
+{
+    void *lib = dlopen("./libmm.so", RTLD_NOW | RTLD_LOCAL);
+    EXPECT(lib != NULL);
+    void *(*lib_malloc)(size_t) = (void *(*)(size_t))dlsym(lib, "malloc");
+    void *(*lib_realloc)(void *, size_t) = (void *(*)(void *, size_t))dlsym(lib, "realloc");
+    void *(*lib_memalign)(size_t, size_t) = (void *(*)(size_t, size_t))dlsym(lib, "memalign");
+    void *(*lib_valloc)(size_t) = (void *(*)(size_t))dlsym(lib, "valloc");
+    void *(*lib_pvalloc)(size_t) = (void *(*)(size_t))dlsym(lib, "pvalloc");
+    EXPECT(lib_malloc && lib_realloc && lib_memalign && lib_valloc && lib_pvalloc);
+
+    errno = 0;
+    EXPECT(lib_malloc(SIZE_MAX) == NULL && errno == ENOMEM);
+    errno = 0;
+    EXPECT(lib_realloc(NULL, SIZE_MAX - 8) == NULL && errno == ENOMEM);
+    errno = 0;
+    EXPECT(lib_memalign(4096, SIZE_MAX - 100) == NULL && errno == ENOMEM);
+    errno = 0;
+    EXPECT(lib_valloc(SIZE_MAX) == NULL && errno == ENOMEM);
+    errno = 0;
+    EXPECT(lib_pvalloc(SIZE_MAX) == NULL && errno == ENOMEM);
+    errno = 0;
+    EXPECT(lib_pvalloc(SIZE_MAX - 4000) == NULL && errno == ENOMEM);
+    return true;
+}
+
+/* realloc to a size that would wrap fails and leaves the block as it was */
+static bool test_realloc_oversized(void)
+{
+    char *p = mm_malloc(100);
+    EXPECT(p != NULL);
+    memset(p, 0x5a, 100);
+    size_t usable = mm_malloc_usable_size(p);
+    EXPECT(mm_realloc(p, SIZE_MAX - 8) == NULL);
+    EXPECT(mm_realloc(p, SIZE_MAX) == NULL);
+    EXPECT(mm_malloc_usable_size(p) == usable);
+    for (int i = 0; i < 100; i++)
+        EXPECT(p[i] == 0x5a);
+    mm_free(p);
+    return true;
+}
+
+/* mm_nallocx is a lower bound on the usable size malloc gives */
+static bool test_nallocx(void)
+{
+    void *live[64] = { NULL };
+    for (size_t n = 1; n < 5000; n += 7) {
+        int i = (int)(n % 64);
+        mm_free(live[i]);
+        live[i] = mm_malloc(n);
+        EXPECT(live[i] != NULL);
+        EXPECT(mm_nallocx(n) >= n);
+        EXPECT(mm_malloc_usable_size(live[i]) >= mm_nallocx(n));
+    }
+    for (int i = 0; i < 64; i++)
+        mm_free(live[i]);
+    return true;
+}
+
+/* Releasing an inner mark keeps what was allocated before it */
+static bool test_arena_marks(void)
+{
+    mm_arena_t *arena = mm_arena_create(1024);
+    EXPECT(arena != NULL);
+    char *outer = mm_arena_alloc(arena, 100);
+    memset(outer, 1, 100);
+    mm_arena_mark_t mark = mm_arena_mark(arena);
+    char *big = mm_arena_alloc(arena, 4000);
+    EXPECT(big != NULL);
+    for (int i = 0; i < 64; i++)
+        memset(mm_arena_alloc(arena, 100), 2, 100);
+    mm_arena_release(arena, mark);
+    for (int i = 0; i < 100; i++)
+        EXPECT(outer[i] == 1);
+    /* the bump position is back where the mark was */
+    char *next = mm_arena_alloc(arena, 16);
+    EXPECT(next == outer + 112);
+
+    /* reset keeps the chunk and starts over at its front */
+    mm_arena_reset(arena);
+    EXPECT(mm_arena_alloc(arena, 16) == outer);
+    EXPECT(mm_arena_alloc(arena, SIZE_MAX) == NULL);
+    EXPECT(mm_arena_alloc(arena, SIZE_MAX - 8) == NULL);
+    EXPECT(mm_arena_create(SIZE_MAX - 8) == NULL);
+    mm_arena_destroy(arena);
+    return true;
+}
+
+/* A mark taken before a reset points at chunks the reset freed */
+static bool test_arena_stale_mark(void)
+{
+    mm_arena_t *arena = mm_arena_create(1024);
+    EXPECT(arena != NULL);
+    for (int i = 0; i < 32; i++)
+        mm_arena_alloc(arena, 100);
+    mm_arena_mark_t mark = mm_arena_mark(arena);
+    mm_arena_alloc(arena, 4000);
+    for (int i = 0; i < 32; i++)
+        mm_arena_alloc(arena, 100);
+    mm_arena_reset(arena);
+    char *kept = mm_arena_alloc(arena, 100);
+    memset(kept, 3, 100);
+    /* releasing it must leave the new generation alone */
+    mm_arena_release(arena, mark);
+    for (int i = 0; i < 100; i++)
+        EXPECT(kept[i] == 3);
+    EXPECT(mm_arena_alloc(arena, 16) == kept + 112);
+    mm_arena_destroy(arena);
+    return true;
+}
+
+/* mm_compact slides handle blocks down over the holes between them */
+static bool test_compact(void)
+{
+    enum { N = 200 };
+    mm_handle_t h[N];
+    void *plain[N];
+    for (int i = 0; i < N; i++) {
+        h[i] = mm_halloc(32 + i % 7 * 48);
+        EXPECT(h[i] != 0);
+        memset(mm_hderef(h[i]), i, 32);
+        plain[i] = mm_malloc(64 + i % 5 * 16);
+    }
+    for (int i = 0; i < N; i++) {
+        mm_free(plain[i]);
+        if (i % 3 == 0)
+            mm_hfree(h[i]);
+    }
+    mm_compact();
+    EXPECT(mm_checkheap(__LINE__));
+    for (int i = 0; i < N; i++) {
+        if (i % 3 == 0)
+            continue;
+        unsigned char *p = mm_hderef(h[i]);
+        for (int b = 0; b < 32; b++)
+            EXPECT(p[b] == (unsigned char)i);
+        mm_hfree(h[i]);
+    }
+    return true;
+}
+
+/* A heap file cut short inside its header is refused, not read */
+static bool test_truncated_heap_file(void)
+{
+    char path[] = "/tmp/mm_test.heap.XXXXXX";
+    int fd = mkstemp(path);
+    EXPECT(fd >= 0);
+    close(fd);
+    unlink(path);
+    pid_t pid = fork();
+    if (pid == 0)
+        _exit(mem_init_file(path, NULL, 0) && mm_init() ? (mem_deinit(), 0) : 1);
+    int status;
+    EXPECT(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    /* past the magic and the address, then inside the magic */
+    bool ok = truncate(path, 20) == 0 && !mem_init_file(path, NULL, 0) &&
+              truncate(path, 4) == 0 && !mem_init_file(path, NULL, 0);
+    unlink(path);
+    EXPECT(ok);
+    return true;
+}
+
+/* Writes text to a new temporary file and returns its path in path */
+static bool write_temp(char *path, const char *text)
+{
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return false;
+    bool ok = write(fd, text, strlen(text)) == (ssize_t)strlen(text);
+    close(fd);
+    return ok;
+}
+
+/* Profile counts that would wrap the carve size are refused or clamped */
+static bool test_profile_counts(void)
+{
+    char huge[] = "/tmp/mm_test.profile.XXXXXX";
+    EXPECT(write_temp(huge, "8 1152921504606846976\n"));
+    bool refused = !mm_set_profile(huge);
+    unlink(huge);
+    EXPECT(refused);
+
+    /* the most the parser takes, at a size that carves past WARM_MAX */
+    char big[] = "/tmp/mm_test.profile.XXXXXX";
+    EXPECT(write_temp(big, "4000 4194304\n"));
+    bool taken = mm_set_profile(big);
+    unlink(big);
+    EXPECT(taken);
+    mem_reset_brk();
+    EXPECT(mm_init());
+    mm_stats_t st;
+    mm_get_stats(&st);
+    EXPECT(st.prewarm_bytes > 0 && st.prewarm_bytes <= (size_t)64 << 20);
+    EXPECT(mm_checkheap(__LINE__));
+    mm_set_profile(NULL);
+    return true;
+}
+
+/* Whether mm_free(p) in a child process stops it with abort() */
+static bool free_aborts(void *p)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        freopen("/dev/null", "w", stderr);     /* heap_abort's report */
+        mm_free(p);
+        _exit(0);
+    }
+    int status;
+    return waitpid(pid, &status, 0) == pid && WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+
+/* Hardened mode refuses stray, misaligned and repeated frees */
+static bool test_hardened_frees(void)
+{
+    int local;
+    char *p = mm_malloc(48);
+    char *q = mm_malloc(5000);
+    EXPECT(p != NULL && q != NULL);
+    EXPECT(free_aborts(&local));
+    EXPECT(free_aborts(p + 8));
+    EXPECT(free_aborts(p + 64 * 1024 * 1024));   /* past the break */
+    EXPECT(free_aborts(q + 1024));
+    mm_free(p);
+    EXPECT(free_aborts(p));
+    mm_free(q);
+    return true;
+}
+
+static void hardened(void)
+{
+    mm_set_hardened(true);
+}
+
+static void side_table(void)
+{
+    mm_set_side_table(true);
+}
+
+static void two_ended(void)
+{
+    mm_set_two_ended(true);
+}
+
+static const struct {
+    const char *name;
+    bool (*run)(void);
+    void (*setup)(void);
+} tests[] = {
+    { "oversized", test_oversized, NULL },
+    { "libmm_oversized", test_libmm_oversized, NULL },
+    { "realloc_oversized", test_realloc_oversized, NULL },
+    { "nallocx", test_nallocx, NULL },
+    { "arena_marks", test_arena_marks, NULL },
+    { "arena_stale_mark", test_arena_stale_mark, NULL },
+    { "profile_counts", test_profile_counts, NULL },
+    { "truncated_heap_file", test_truncated_heap_file, NULL },
+    { "hardened_frees", test_hardened_frees, hardened },
+    { "compact", test_compact, NULL },
+    { "compact_side_table", test_compact, side_table },
+    { "compact_two_ended", test_compact, two_ended },
+};
+
+/* Runs one test in a child; true if it passed and left a sound heap */
+static bool run_test(bool (*run)(void), void (*setup)(void))
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (setup != NULL)
+            setup();
+        mem_init();
+        if (!mm_init())
+            _exit(2);
+        bool ok = run() && mm_checkheap(__LINE__);
+        fflush(stdout);         /* mm_checkheap reports on stdout */
+        _exit(ok ? 0 : 1);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        return false;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    int failed = 0, ran = 0;
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        if (argc > 1 && strncmp(tests[i].name, argv[1], strlen(argv[1])) != 0)
+            continue;
+        bool ok = run_test(tests[i].run, tests[i].setup);
+        printf("%-24s %s\n", tests[i].name, ok ? "ok" : "FAILED");
+        failed += !ok;
+        ran++;
+    }
+    printf("%d of %d tests passed\n", ran - failed, ran);
+    return failed == 0 ? 0 : 1;
+}
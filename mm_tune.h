@@ -0,0 +1,48 @@
+#ifndef __MM_TUNE_H_
+#define __MM_TUNE_H_
+
+/*
+ * mm_tune.h - build-time tunables for mm.c.
+ *
+ * Each setting can be overridden with -D on the compiler command line
+ * (the Makefile passes TUNE_FLAGS through), or all at once from the
+ * mm_tuned.h that autotune.pl writes: `make TUNE=index` takes its best
+ * performance index settings, TUNE=space its best utilization and
+ * TUNE=speed its best throughput. The defaults are the hand-tuned values.
+ */
+#ifdef MM_TUNED
+#include "mm_tuned.h"
+#endif
+
+/* Upper bounds of the first 13 of the 14 segregated size classes */
+#ifndef MM_CLASS_BOUNDS
+#define MM_CLASS_BOUNDS 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, \
+                        16384, 32768, 65536, 131072
+#endif
+
+/* split() only carves off a remainder of at least this many bytes */
+#ifndef MM_SPLIT_MIN
+#define MM_SPLIT_MIN 32
+#endif
+
+/* The heap grows by at least this much at a time; 0 grows by the request */
+#ifndef MM_GROW_CHUNK
+#define MM_GROW_CHUNK 0
+#endif
+
+/* Free blocks up to this size go to the exact-size fast bins */
+#ifndef MM_FAST_MAX
+#define MM_FAST_MAX 256
+#endif
+
+#if MM_SPLIT_MIN < 32 || MM_SPLIT_MIN % 16 != 0
+#error "MM_SPLIT_MIN must be a multiple of 16 and at least 32"
+#endif
+#if MM_GROW_CHUNK % 16 != 0
+#error "MM_GROW_CHUNK must be a multiple of 16"
+#endif
+#if MM_FAST_MAX < 32 || MM_FAST_MAX > 1024 || MM_FAST_MAX % 16 != 0
+#error "MM_FAST_MAX must be a multiple of 16 between 32 and 1024"
+#endif
+
+#endif /* __MM_TUNE_H_ */
@@ -0,0 +1,148 @@
+/*
+ * new_bench.cc - allocation-heavy C++ on the replaced global operator new.
+ *
+ * Linked with mm_new.o, so new/delete and std::allocator go to mm. Each
+ * workload also runs on the C library malloc (placement new, or an
+ * allocator over std::malloc) as the baseline:
+ *   objects - new/delete churn over 24, 48 and 96 byte objects, with
+ *             mm's unsized delete and with the sized delete the compiler
+ *             emits by default
+ *   map     - std::map insert/erase waves
+ * The mm heap is set up by operator new and never reset, since the C++
+ * runtime may hold blocks in it.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <new>
+
+#include "mm.h"
+extern "C" {
+#include "fcyc.h"
+}
+
+template <int N>
+struct object {
+    long words[N];
+    explicit object(long v) { words[0] = v; words[N - 1] = v; }
+};
+
+typedef object<3> small_obj;
+typedef object<6> medium_obj;
+typedef object<12> large_obj;
+
+static const int OBJECTS = 30000;
+static const int ROUNDS = 5;
+static const int MAP_KEYS = 50000;
+static const int MAP_WAVES = 4;
+
+static small_obj *smalls[OBJECTS];
+static medium_obj *mediums[OBJECTS];
+static large_obj *larges[OBJECTS];
+static volatile long sink;
+
+/* How each workload gets and drops its objects */
+struct libc_policy {
+    template <typename T>
+    static T *make(long v)
+    {
+        void *p = std::malloc(sizeof(T));
+        if (p == nullptr)
+            throw std::bad_alloc();
+        return new (p) T(v);
+    }
+    template <typename T>
+    static void drop(T *p) { p->~T(); std::free(p); }
+};
+
+struct unsized_policy {
+    template <typename T>
+    static T *make(long v) { return new (::operator new(sizeof(T))) T(v); }
+    template <typename T>
+    static void drop(T *p) { p->~T(); ::operator delete(p); }
+};
+
+struct sized_policy {
+    template <typename T>
+    static T *make(long v) { return new T(v); }
+    template <typename T>
+    static void drop(T *p) { delete p; }
+};
+
+template <typename P>
+static void object_churn(void *arg)
+{
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < OBJECTS; i++) {
+            smalls[i] = P::template make<small_obj>(i);
+            mediums[i] = P::template make<medium_obj>(i);
+            larges[i] = P::template make<large_obj>(i);
+        }
+        for (int i = 0; i < OBJECTS; i += 2) {
+            P::drop(mediums[i]);
+            mediums[i] = P::template make<medium_obj>(r);
+        }
+        for (int i = 0; i < OBJECTS; i++) {
+            sink += smalls[i]->words[0] + mediums[i]->words[5] + larges[i]->words[11];
+            P::drop(smalls[i]);
+            P::drop(mediums[i]);
+            P::drop(larges[i]);
+        }
+    }
+}
+
+template <typename T>
+struct malloc_allocator {
+    typedef T value_type;
+    malloc_allocator() noexcept {}
+    template <typename U>
+    malloc_allocator(const malloc_allocator<U> &) noexcept {}
+    T *allocate(std::size_t n)
+    {
+        void *p = std::malloc(n * sizeof(T));
+        if (p == nullptr)
+            throw std::bad_alloc();
+        return static_cast<T *>(p);
+    }
+    void deallocate(T *p, std::size_t) noexcept { std::free(p); }
+    bool operator==(const malloc_allocator &) const noexcept { return true; }
+    bool operator!=(const malloc_allocator &) const noexcept { return false; }
+};
+
+template <typename Alloc>
+static void map_churn(void *arg)
+{
+    std::map<long, long, std::less<long>, Alloc> m;
+    for (int w = 0; w < MAP_WAVES; w++) {
+        for (long k = 0; k < MAP_KEYS; k++)
+            m.emplace(k * 7 + w, k);
+        for (long k = 0; k < MAP_KEYS; k += 2)
+            m.erase(k * 7 + w);
+    }
+    sink += (long)m.size();
+}
+
+int main()
+{
+    typedef std::pair<const long, long> entry;
+
+    double ops = ROUNDS * (3.0 * OBJECTS + OBJECTS) * 2;
+    double libc_secs = fsec(object_churn<libc_policy>, nullptr);
+    double unsized_secs = fsec(object_churn<unsized_policy>, nullptr);
+    double sized_secs = fsec(object_churn<sized_policy>, nullptr);
+
+    printf("%-28s %10s %8s\n", "", "Kops", "vs libc");
+    printf("%-28s %10.0f %8.2f\n", "objects: libc malloc", ops / libc_secs * 1e-3, 1.0);
+    printf("%-28s %10.0f %8.2f\n", "objects: mm, unsized delete",
+           ops / unsized_secs * 1e-3, libc_secs / unsized_secs);
+    printf("%-28s %10.0f %8.2f\n", "objects: mm, sized delete",
+           ops / sized_secs * 1e-3, libc_secs / sized_secs);
+
+    ops = 1.5 * MAP_KEYS * MAP_WAVES;
+    libc_secs = fsec(map_churn<malloc_allocator<entry>>, nullptr);
+    double mm_secs = fsec(map_churn<std::allocator<entry>>, nullptr);
+    printf("%-28s %10.0f %8.2f\n", "map: libc malloc", ops / libc_secs * 1e-3, 1.0);
+    printf("%-28s %10.0f %8.2f\n", "map: mm operator new",
+           ops / mm_secs * 1e-3, libc_secs / mm_secs);
+    return 0;
+}
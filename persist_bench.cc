@@ -0,0 +1,202 @@
+/*
+ * persist_bench.cc - restarting with a warm heap: rebuilding it against
+ * reattaching to a heap file (mem_init_file).
+ *
+ * The warm state is a chained hash table of N entries with values of 16
+ * to 112 bytes, all on the mm heap. Each phase runs in a process of its
+ * own, so every restart really starts from nothing:
+ *   rebuild  - an anonymous heap, table built from scratch
+ *   create   - the same into a new heap file, then a clean shutdown
+ *   reattach - maps the file and finds the table through mm_get_root
+ *   recover  - the same after a process that replaced 1/7 of the entries
+ *              and then died without mem_deinit, so mm_init checks every
+ *              block and rebuilds the free lists
+ * The time is from process start to a usable table; the table is then
+ * checked entry by entry (not timed), and so is the heap.
+ */
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+static const size_t ENTRIES = 1 << 20;
+
+struct node {
+    node *next;
+    uint64_t key;
+    uint32_t len;
+    unsigned char data[];
+};
+
+struct table {
+    size_t buckets;
+    size_t entries;
+    node **slots;
+};
+
+static uint32_t value_len(uint64_t key)
+{
+    return 16 + (uint32_t)(key * 2654435761u % 97);
+}
+
+static void insert(table *t, uint64_t key)
+{
+    uint32_t len = value_len(key);
+    node *n = static_cast<node *>(mm_malloc(sizeof(node) + len));
+    if (n == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        _exit(2);
+    }
+    n->key = key;
+    n->len = len;
+    memset(n->data, (int)(key * 31), len);
+    node **slot = &t->slots[key % t->buckets];
+    n->next = *slot;
+    *slot = n;
+    t->entries++;
+}
+
+static void erase(table *t, uint64_t key)
+{
+    for (node **p = &t->slots[key % t->buckets]; *p != nullptr; p = &(*p)->next) {
+        if ((*p)->key == key) {
+            node *n = *p;
+            *p = n->next;
+            mm_free(n);
+            t->entries--;
+            return;
+        }
+    }
+}
+
+static table *build(size_t entries)
+{
+    table *t = static_cast<table *>(mm_malloc(sizeof(table)));
+    t->buckets = entries;
+    t->entries = 0;
+    t->slots = static_cast<node **>(mm_calloc(entries, sizeof(node *)));
+    for (uint64_t k = 0; k < entries; k++)
+        insert(t, k);
+    return t;
+}
+
+/* every key present once with the right value, and a sound heap */
+static bool verify(const table *t, size_t entries)
+{
+    if (t == nullptr || t->entries != entries)
+        return false;
+    size_t found = 0;
+    for (size_t b = 0; b < t->buckets; b++) {
+        for (const node *n = t->slots[b]; n != nullptr; n = n->next) {
+            if (n->key % t->buckets != b || n->len != value_len(n->key))
+                return false;
+            for (uint32_t i = 0; i < n->len; i++)
+                if (n->data[i] != (unsigned char)(n->key * 31))
+                    return false;
+            found++;
+        }
+    }
+    return found == entries && mm_checkheap(__LINE__);
+}
+
+enum phase { REBUILD, CREATE, REATTACH, CRASH, RECOVER };
+
+/* One phase in this (child) process: exit status 0 if the table checked out */
+static int run_phase(phase p, const char *path, size_t entries, int out)
+{
+    auto start = std::chrono::steady_clock::now();
+    table *t;
+    if (p == REBUILD) {
+        mem_init();
+    } else if (!mem_init_file(path, nullptr, 0)) {
+        fprintf(stderr, "cannot map %s\n", path);
+        return 1;
+    }
+    if (!mm_init())
+        return 1;
+    if (p == REBUILD || p == CREATE) {
+        t = build(entries);
+        mm_set_root(t);
+    } else {
+        t = static_cast<table *>(mm_get_root());
+    }
+    if (p == CREATE)
+        mem_deinit();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (write(out, &ms, sizeof(ms)) != sizeof(ms))
+        return 1;
+
+    if (p == CREATE)
+        return 0;
+    if (p == CRASH) {
+        for (uint64_t k = 0; k < entries; k += 7) {
+            erase(t, k);
+            insert(t, k);
+        }
+        _exit(0);
+    }
+    bool ok = verify(t, entries);
+    if (p != REBUILD)
+        mem_deinit();
+    return ok ? 0 : 1;
+}
+
+/* Runs a phase in a child; its time in ms, negative if it failed */
+static double phase_ms(phase p, const char *path, size_t entries)
+{
+    int fds[2];
+    double ms = -1;
+    if (pipe(fds) != 0)
+        return -1;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        _exit(run_phase(p, path, entries, fds[1]));
+    }
+    close(fds[1]);
+    int status = 1;
+    if (read(fds[0], &ms, sizeof(ms)) != sizeof(ms))
+        ms = -1;
+    close(fds[0]);
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? ms : -1;
+}
+
+int main(int argc, char **argv)
+{
+    size_t entries = argc > 1 ? strtoul(argv[1], nullptr, 0) : ENTRIES;
+    const char *path = argc > 2 ? argv[2] : "/tmp/persist_bench.heap";
+    unlink(path);
+
+    static const struct {
+        phase p;
+        const char *name;
+    } phases[] = {
+        { REBUILD, "rebuild" },
+        { CREATE, "create" },
+        { REATTACH, "reattach" },
+        { CRASH, nullptr },
+        { RECOVER, "recover" },
+    };
+    printf("%zu entries\n%-10s %10s\n", entries, "", "ms");
+    bool ok = true;
+    for (const auto &ph : phases) {
+        double ms = phase_ms(ph.p, path, entries);
+        if (ms < 0) {
+            printf("%-10s %10s\n", ph.name ? ph.name : "crash", "FAILED");
+            ok = false;
+            break;
+        }
+        if (ph.name != nullptr)
+            printf("%-10s %10.2f\n", ph.name, ms);
+    }
+    unlink(path);
+    return ok ? 0 : 1;
+}
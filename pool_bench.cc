@@ -0,0 +1,110 @@
+/*
+ * pool_bench.cc - mm::pool<T> against new/delete on the mm heap.
+ *
+ * Both sides run the same churn over tree-node sized objects: build a
+ * batch, free every other node, refill the holes, then tear everything
+ * down, for several rounds. "new/delete" is placement new into mm_malloc
+ * followed by an explicit destructor call and mm_free, i.e. what a global
+ * operator new on mm would do. Times are K-best fsec() runs, each on a
+ * freshly reset heap, as in mdriver.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_pool.h"
+extern "C" {
+#include "fcyc.h"
+}
+
+struct node {
+    node *left;
+    node *right;
+    long key;
+    long value;
+    node(long k, long v) : left(nullptr), right(nullptr), key(k), value(v) {}
+};
+
+static const int NODES = 100000;
+static const int ROUNDS = 5;
+static node *live[NODES];
+static size_t heap_used;
+
+static node *mm_new(long k, long v)
+{
+    void *p = mm_malloc(sizeof(node));
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return new (p) node(k, v);
+}
+
+static void mm_delete(node *n)
+{
+    n->~node();
+    mm_free(n);
+}
+
+static void reset_heap()
+{
+    mem_reset_brk();
+    if (!mm_init()) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+}
+
+static void run_new(void *arg)
+{
+    reset_heap();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < NODES; i++)
+            live[i] = mm_new(i, r);
+        for (int i = 0; i < NODES; i += 2)
+            mm_delete(live[i]);
+        for (int i = 0; i < NODES; i += 2)
+            live[i] = mm_new(i, r);
+        for (int i = 0; i < NODES; i++)
+            mm_delete(live[i]);
+    }
+    heap_used = mm_heapsize();
+}
+
+static void run_pool(void *arg)
+{
+    reset_heap();
+    mm::pool<node> pool;
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < NODES; i++)
+            live[i] = pool.construct(i, r);
+        for (int i = 0; i < NODES; i += 2)
+            pool.destroy(live[i]);
+        for (int i = 0; i < NODES; i += 2)
+            live[i] = pool.construct(i, r);
+        for (int i = 0; i < NODES; i++)
+            pool.destroy(live[i]);
+    }
+    heap_used = mm_heapsize();
+}
+
+int main()
+{
+    double ops = 3.0 * NODES * ROUNDS;   /* NODES + NODES/2 each way */
+
+    mem_init();
+
+    double new_secs = fsec(run_new, nullptr);
+    size_t new_heap = heap_used;
+    double pool_secs = fsec(run_pool, nullptr);
+    size_t pool_heap = heap_used;
+
+    printf("%-22s %10s %12s\n", "", "Kops", "heap bytes");
+    printf("%-22s %10.0f %12zu\n", "new/delete on mm", ops / new_secs * 1e-3, new_heap);
+    printf("%-22s %10.0f %12zu\n", "mm::pool<node>", ops / pool_secs * 1e-3, pool_heap);
+    printf("pool/new = %.2f (slot %zu bytes, node %zu bytes)\n",
+           new_secs / pool_secs, mm::pool<node>::slot_bytes(), sizeof(node));
+
+    mem_deinit();
+    return 0;
+}
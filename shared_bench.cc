@@ -0,0 +1,242 @@
+/*
+ * shared_bench.cc - worker processes sharing one heap (mm_shared_open).
+ *
+ * The parent builds a chained hash table of N entries in a shared heap,
+ * its links stored as offsets, and publishes it as the heap's root. For
+ * 1 to MAX_PROCS processes (or the argument) each forked worker opens
+ * the segment by name, which maps it at an address of its own since the
+ * parent's mapping is still there, and then for SECONDS each:
+ *   lookup - looks up random keys through the offsets and checks values
+ *   churn  - mm_heap_malloc/mm_heap_free pairs of 16 to 256 bytes, with
+ *            64 blocks live per process
+ * The tables give million lookups and thousand pairs per second over all
+ * workers; churn on a private heap (mm_heap_create) holding as many
+ * blocks is the reference for what the lock and the image copies cost.
+ * Last, a churning worker is killed at random points KILLS times, and
+ * the table is checked again.
+ */
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mm.h"
+
+static const char *NAME = "/mm_shared_bench";
+static const size_t ENTRIES = 1 << 18;
+static const int MAX_PROCS = 8;
+static const int LIVE = 64;
+static const int KILLS = 50;
+static const double SECONDS = 0.3;
+
+struct node {
+    size_t next;        /* offset of the next node in the chain */
+    uint64_t key;
+    uint64_t value;
+};
+
+struct table {
+    size_t buckets;
+    size_t slots;       /* offset of the bucket array */
+};
+
+static mm_heap_t *heap;
+
+static node *at(size_t off)
+{
+    return static_cast<node *>(mm_shared_ptr(heap, off));
+}
+
+static uint64_t value_of(uint64_t key)
+{
+    return key * 0x9E3779B97F4A7C15ull;
+}
+
+static void build(size_t entries)
+{
+    table *t = static_cast<table *>(mm_heap_malloc(heap, sizeof(table)));
+    size_t *slots = static_cast<size_t *>(mm_heap_malloc(heap, entries * sizeof(size_t)));
+    memset(slots, 0, entries * sizeof(size_t));
+    t->buckets = entries;
+    t->slots = mm_shared_offset(heap, slots);
+    for (uint64_t k = 0; k < entries; k++) {
+        node *n = static_cast<node *>(mm_heap_malloc(heap, sizeof(node)));
+        n->key = k;
+        n->value = value_of(k);
+        n->next = slots[k % entries];
+        slots[k % entries] = mm_shared_offset(heap, n);
+    }
+    mm_heap_set_root(heap, t);
+}
+
+/* the value stored under key, or ~0 if it is missing */
+static uint64_t lookup(const table *t, uint64_t key)
+{
+    const size_t *slots = static_cast<const size_t *>(mm_shared_ptr(heap, t->slots));
+    for (node *n = at(slots[key % t->buckets]); n != nullptr; n = at(n->next))
+        if (n->key == key)
+            return n->value;
+    return ~(uint64_t)0;
+}
+
+static bool check_all(const table *t)
+{
+    for (uint64_t k = 0; k < t->buckets; k++)
+        if (lookup(t, k) != value_of(k))
+            return false;
+    return true;
+}
+
+/* malloc/free pairs on h until stop, or forever if stop is null */
+static long churn(mm_heap_t *h, unsigned seed, const volatile bool *stop)
+{
+    void *live[LIVE] = {};
+    long pairs = 0;
+    for (int i = 0; stop == nullptr || !*stop; i = (i + 1) % LIVE) {
+        seed = seed * 1103515245 + 12345;
+        mm_heap_free(h, live[i]);
+        live[i] = mm_heap_malloc(h, 16 + (seed >> 16) % 241);
+        if (live[i] == nullptr) {
+            fprintf(stderr, "out of memory\n");
+            _exit(1);
+        }
+        pairs++;
+    }
+    for (void *p : live)
+        mm_heap_free(h, p);
+    return pairs;
+}
+
+static volatile bool stop;
+
+static void on_alarm(int)
+{
+    stop = true;
+}
+
+static void stop_after(double secs)
+{
+    stop = false;
+    signal(SIGALRM, on_alarm);
+    ualarm((useconds_t)(secs * 1e6), 0);
+}
+
+/* One worker: opens the heap by name and reports ops per second */
+static double worker(bool lookups, unsigned seed)
+{
+    heap = mm_shared_open(NAME, 0);
+    if (heap == nullptr)
+        return -1;
+    const table *t = static_cast<const table *>(mm_heap_get_root(heap));
+    long ops = 0;
+    auto start = std::chrono::steady_clock::now();
+    stop_after(SECONDS);
+    if (lookups) {
+        while (!stop) {
+            for (int i = 0; i < 256; i++) {
+                seed = seed * 1103515245 + 12345;
+                uint64_t key = (seed >> 8) % t->buckets;
+                if (lookup(t, key) != value_of(key))
+                    return -1;
+            }
+            ops += 256;
+        }
+    } else {
+        ops = churn(heap, seed, &stop);
+    }
+    return ops / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* Ops per second over procs workers, or negative if one failed */
+static double run(int procs, bool lookups)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return -1;
+    fflush(stdout);
+    for (int p = 0; p < procs; p++) {
+        if (fork() == 0) {
+            close(fds[0]);
+            double rate = worker(lookups, (unsigned)p * 7919 + 1);
+            _exit(write(fds[1], &rate, sizeof(rate)) == sizeof(rate) ? 0 : 1);
+        }
+    }
+    close(fds[1]);
+    double total = 0, rate;
+    for (int p = 0; p < procs; p++) {
+        if (read(fds[0], &rate, sizeof(rate)) != sizeof(rate) || rate < 0)
+            total = -1e300;
+        total += rate;
+    }
+    close(fds[0]);
+    for (int p = 0; p < procs; p++)
+        wait(nullptr);
+    return total;
+}
+
+/* Kills a churning worker KILLS times; the heap's rebuild count after */
+static size_t kill_workers(void)
+{
+    srand(1);
+    for (int k = 0; k < KILLS; k++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            heap = mm_shared_open(NAME, 0);
+            churn(heap, (unsigned)k, nullptr);
+        }
+        usleep(2000 + rand() % 3000);
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+    }
+    mm_stats_t s;
+    mm_heap_get_stats(heap, &s);
+    return s.rebuilds;
+}
+
+int main(int argc, char **argv)
+{
+    int max = argc > 1 ? atoi(argv[1]) : MAX_PROCS;
+    shm_unlink(NAME);
+    heap = mm_shared_open(NAME, 0);
+    if (heap == nullptr) {
+        fprintf(stderr, "cannot create %s\n", NAME);
+        return 1;
+    }
+    build(ENTRIES);
+    const table *t = static_cast<const table *>(mm_heap_get_root(heap));
+
+    mm_heap_t *priv = mm_heap_create();
+    mm_heap_malloc(priv, ENTRIES * sizeof(size_t));
+    for (size_t k = 0; k < ENTRIES; k++)
+        mm_heap_malloc(priv, sizeof(node));
+    stop_after(SECONDS);
+    auto start = std::chrono::steady_clock::now();
+    long pairs = churn(priv, 1, &stop);
+    double priv_rate = pairs / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    mm_heap_destroy(priv);
+
+    printf("%zu entries, private heap churn %.0f K pairs/s\n", ENTRIES, priv_rate * 1e-3);
+    printf("%-8s %14s %14s\n", "procs", "lookup M/s", "churn K/s");
+    for (int p = 1; p <= max; p *= 2) {
+        double l = run(p, true);
+        double c = run(p, false);
+        if (l < 0 || c < 0) {
+            printf("%-8d FAILED\n", p);
+            shm_unlink(NAME);
+            return 1;
+        }
+        printf("%-8d %14.1f %14.0f\n", p, l * 1e-6, c * 1e-3);
+    }
+
+    size_t rebuilds = kill_workers();
+    bool ok = check_all(t) && mm_heap_malloc(heap, 64) != nullptr;
+    printf("%d workers killed, %zu heap rebuilds, table %s\n", KILLS, rebuilds, ok ? "intact" : "DAMAGED");
+    mm_heap_destroy(heap);
+    shm_unlink(NAME);
+    return ok ? 0 : 1;
+}
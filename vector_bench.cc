@@ -0,0 +1,179 @@
+/*
+ * vector_bench.cc - vector push_back growth with and without mm_nallocx
+ * and mm_xallocx.
+ *
+ * A minimal vector of longs grows on the mm heap in one of three ways:
+ *   copy    - doubles its capacity into a new block, copies and frees the
+ *             old one, as std::vector does
+ *   realloc - doubles with mm_realloc, which grows in place when it can
+ *   xallocx - tries mm_xallocx to double in place first, and on a copy
+ *             takes the whole capacity mm_nallocx says the block has
+ * over two workloads, each run K-best with fsec() on a freshly reset heap:
+ *   side    - many vectors of assorted lengths grown side by side, so
+ *             most neighbours are other vectors
+ *   single  - one long vector, which ends up at the heap end
+ * std::vector on mm::allocator is the reference. The second table gives
+ * the payload bytes each way copied (or remapped) while growing.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_resource.h"
+extern "C" {
+#include "fcyc.h"
+}
+
+static const int VECTORS = 2000;
+static const int VECTOR_LEN = 1000;  /* longest; lengths vary over 100.. */
+static const int SINGLE_LEN = 1 << 21;
+
+static volatile long sink;   /* keeps the optimizer from dropping the work */
+static size_t copied;        /* bytes the vectors copied themselves */
+
+enum grow_mode { GROW_COPY, GROW_REALLOC, GROW_XALLOCX };
+
+template <grow_mode M>
+class mm_vector {
+public:
+    mm_vector() : data_(nullptr), size_(0), cap_(0) {}
+    ~mm_vector() { mm_free(data_); }
+
+    mm_vector(const mm_vector &) = delete;
+    mm_vector &operator=(const mm_vector &) = delete;
+
+    void push_back(long v)
+    {
+        if (size_ == cap_)
+            grow();
+        data_[size_++] = v;
+    }
+    long back() const { return data_[size_ - 1]; }
+
+private:
+    void grow()
+    {
+        size_t bytes = (cap_ ? 2 * cap_ : 4) * sizeof(long);
+        /* a partial growth would only bring the next copy closer */
+        if (M == GROW_XALLOCX && data_ != nullptr) {
+            size_t got = mm_xallocx(data_, bytes, 0);
+            if (got >= bytes) {
+                cap_ = got / sizeof(long);
+                return;
+            }
+        }
+        if (M == GROW_REALLOC) {
+            data_ = static_cast<long *>(mm_realloc(data_, bytes));
+        } else {
+            if (M == GROW_XALLOCX)
+                bytes = mm_nallocx(bytes);
+            long *p = static_cast<long *>(mm_malloc(bytes));
+            if (p != nullptr && data_ != nullptr) {
+                memcpy(p, data_, size_ * sizeof(long));
+                copied += size_ * sizeof(long);
+            }
+            mm_free(data_);
+            data_ = p;
+        }
+        if (data_ == nullptr) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        cap_ = bytes / sizeof(long);
+    }
+
+    long *data_;
+    size_t size_;
+    size_t cap_;
+};
+
+typedef std::vector<long, mm::allocator<long>> std_vector;
+
+static void reset_heap()
+{
+    mem_reset_brk();
+    if (!mm_init()) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+}
+
+/* Spread the lengths so no one capacity step decides the copy count */
+static int side_len(int v)
+{
+    return 100 + v * 7 % (VECTOR_LEN - 100);
+}
+
+template <typename V>
+static void side_by_side(void *arg)
+{
+    reset_heap();
+    std::vector<V> vs(VECTORS);
+    for (int i = 0; i < VECTOR_LEN; i++)
+        for (int v = 0; v < VECTORS; v++)
+            if (i < side_len(v))
+                vs[v].push_back(i + v);
+    sink += vs[VECTORS - 1].back();
+}
+
+template <typename V>
+static void single(void *arg)
+{
+    reset_heap();
+    V v;
+    for (int i = 0; i < SINGLE_LEN; i++)
+        v.push_back(i);
+    sink += v.back();
+}
+
+/* Bytes one untimed run of fn copies, by the vector or inside mm_realloc */
+static double copied_by(void (*fn)(void *))
+{
+    copied = 0;
+    fn(nullptr);
+    mm_stats_t stats;
+    mm_get_stats(&stats);
+    return (double)(copied + stats.realloc_copied + stats.realloc_remapped);
+}
+
+static void report(const char *name, double ops, void (*fns[4])(void *))
+{
+    double secs[4], bytes[4];
+    for (int i = 0; i < 4; i++) {
+        secs[i] = fsec(fns[i], nullptr);
+        bytes[i] = copied_by(fns[i]);
+    }
+    printf("%-8s Kops %10.0f %10.0f %10.0f %10.0f\n", name,
+           ops / secs[0] * 1e-3, ops / secs[1] * 1e-3, ops / secs[2] * 1e-3,
+           ops / secs[3] * 1e-3);
+    printf("%-8s MB   %10s %10.1f %10.1f %10.1f\n", "", "-",
+           bytes[1] / 1e6, bytes[2] / 1e6, bytes[3] / 1e6);
+}
+
+int main()
+{
+    mem_init();
+
+    printf("%-13s %10s %10s %10s %10s\n", "", "std", "copy", "realloc", "xallocx");
+
+    void (*side_fns[4])(void *) = {
+        side_by_side<std_vector>, side_by_side<mm_vector<GROW_COPY>>,
+        side_by_side<mm_vector<GROW_REALLOC>>, side_by_side<mm_vector<GROW_XALLOCX>>,
+    };
+    double ops = 0;
+    for (int v = 0; v < VECTORS; v++)
+        ops += side_len(v);
+    report("side", ops, side_fns);
+
+    void (*single_fns[4])(void *) = {
+        single<std_vector>, single<mm_vector<GROW_COPY>>,
+        single<mm_vector<GROW_REALLOC>>, single<mm_vector<GROW_XALLOCX>>,
+    };
+    report("single", (double)SINGLE_LEN, single_fns);
+
+    mem_deinit();
+    return 0;
+}